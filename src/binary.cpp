@@ -0,0 +1,289 @@
+#include "binary.hpp"
+#include "file.hpp"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace binary {
+
+static_assert(std::is_trivially_copyable_v<TriangleFace> &&
+                  std::is_trivially_copyable_v<PointLight> &&
+                  std::is_trivially_copyable_v<AmbientLight>,
+              "arrays are stored as they are in memory");
+
+// NOTE: the layout of the file, changing any of these needs a new version
+static_assert(sizeof(V3) == 12 && sizeof(V4) == 16 && sizeof(V2u) == 8,
+              "vectors are stored as packed components");
+static_assert(sizeof(AmbientLight) == 12 && sizeof(PointLight) == 24 &&
+                  offsetof(PointLight, intensity) == 12,
+              "light layout");
+static_assert(sizeof(TriangleFace) == 48 &&
+                  offsetof(TriangleFace, vertices) == 0 &&
+                  offsetof(TriangleFace, color) == 36,
+              "face layout");
+static_assert(sizeof(Section) == 16 && offsetof(Section, count) == 8,
+              "section layout");
+static_assert(sizeof(CameraRecord) == 64 &&
+                  offsetof(CameraRecord, gaze) == 12 &&
+                  offsetof(CameraRecord, up) == 24 &&
+                  offsetof(CameraRecord, near_plane) == 36 &&
+                  offsetof(CameraRecord, near_dist) == 52 &&
+                  offsetof(CameraRecord, resolution) == 56,
+              "camera layout");
+static_assert(sizeof(MaterialRecord) == 52 &&
+                  offsetof(MaterialRecord, diffuse) == 12 &&
+                  offsetof(MaterialRecord, specular) == 24 &&
+                  offsetof(MaterialRecord, phong) == 36 &&
+                  offsetof(MaterialRecord, reflectance) == 40,
+              "material layout");
+static_assert(sizeof(MeshRecord) == 24 &&
+                  offsetof(MeshRecord, reserved) == 4 &&
+                  offsetof(MeshRecord, first_face) == 8 &&
+                  offsetof(MeshRecord, face_count) == 16,
+              "mesh layout");
+static_assert(sizeof(Header) == 216 && offsetof(Header, version) == 8 &&
+                  offsetof(Header, byte_order_mark) == 12 &&
+                  offsetof(Header, file_size) == 16 &&
+                  offsetof(Header, max_ray_trace_depth) == 24 &&
+                  offsetof(Header, bg_color) == 28 &&
+                  offsetof(Header, cam) == 40 &&
+                  offsetof(Header, ambient_lights) == 104 &&
+                  offsetof(Header, point_lights) == 120 &&
+                  offsetof(Header, materials) == 136 &&
+                  offsetof(Header, vertices) == 152 &&
+                  offsetof(Header, meshes) == 168 &&
+                  offsetof(Header, indices) == 184 &&
+                  offsetof(Header, faces) == 200,
+              "header layout, without padding");
+
+constexpr const char *fmt_bad_section = "Bad '%s' section in binary scene\n";
+
+bool is_binary(const char *data, umax size) {
+  return size >= sizeof(magic) && memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+/// Elements of section in data, nullptr if they're out of the file or
+/// misaligned.
+template <class T>
+static const T *array_of(const Section &section, const char *data, umax size,
+                         const char *name) {
+  if (section.offset % alignof(T) != 0 || section.offset > size ||
+      section.count > (size - section.offset) / sizeof(T)) {
+    fprintf(stderr, fmt_bad_section, name);
+    return nullptr;
+  }
+
+  return reinterpret_cast<const T *>(data + section.offset);
+}
+
+int to_scene(Scene &scene, const char *data, umax size) {
+  Header header;
+
+  if (size < sizeof(header) || !is_binary(data, size)) {
+    fprintf(stderr, "Not a binary scene\n");
+    return -1;
+  }
+
+  memcpy(&header, data, sizeof(header));
+
+  if (header.byte_order_mark != byte_order_mark) {
+    fprintf(stderr, "Binary scene was written with another byte order\n");
+    return -1;
+  }
+
+  if (header.version != version) {
+    fprintf(stderr, "Binary scene version is %u, expected %u\n",
+            header.version, version);
+    return -1;
+  }
+
+  if (header.file_size != size) {
+    fprintf(stderr, "Binary scene size is %ju, expected %ju\n", size,
+            static_cast<umax>(header.file_size));
+    return -1;
+  }
+
+  const AmbientLight *ambient_lights = array_of<AmbientLight>(
+      header.ambient_lights, data, size, "ambient lights");
+  const PointLight *point_lights =
+      array_of<PointLight>(header.point_lights, data, size, "point lights");
+  const MaterialRecord *materials =
+      array_of<MaterialRecord>(header.materials, data, size, "materials");
+  const V3 *vertices = array_of<V3>(header.vertices, data, size, "vertices");
+  const MeshRecord *meshes =
+      array_of<MeshRecord>(header.meshes, data, size, "meshes");
+  const u32 *indices = array_of<u32>(header.indices, data, size, "indices");
+  const TriangleFace *faces =
+      array_of<TriangleFace>(header.faces, data, size, "faces");
+
+  if (!ambient_lights || !point_lights || !materials || !vertices ||
+      !meshes || !indices || !faces)
+    return -1;
+
+  scene.max_ray_trace_depth = header.max_ray_trace_depth;
+  scene.bg_color = header.bg_color;
+
+  Camera &cam = scene.cam;
+  cam.pos = header.cam.pos;
+  cam.gaze = header.cam.gaze;
+  cam.up = header.cam.up;
+  cam.near_plane = header.cam.near_plane;
+  cam.near_dist = header.cam.near_dist;
+  cam.resolution = header.cam.resolution;
+  orient(cam);
+
+  scene.ambient_lights.assign(ambient_lights,
+                              ambient_lights + header.ambient_lights.count);
+  scene.point_lights.assign(point_lights,
+                            point_lights + header.point_lights.count);
+
+  scene.materials.resize(header.materials.count);
+  for (u64 i = 0; i < header.materials.count; ++i) {
+    const MaterialRecord &record = materials[i];
+    Material &material = scene.materials[i];
+
+    material.id = std::to_string(i + 1);
+    material.ambient = record.ambient;
+    material.diffuse = record.diffuse;
+    material.specular = record.specular;
+    material.phong = record.phong;
+    material.reflectance = record.reflectance;
+  }
+
+  // NOTE: geometry stays in the file, only spans point into it
+  scene.vertex_storage.clear();
+  scene.vertices = {vertices, header.vertices.count};
+
+  scene.meshes.resize(header.meshes.count);
+  for (u64 i = 0; i < header.meshes.count; ++i) {
+    const MeshRecord &record = meshes[i];
+    Mesh &mesh = scene.meshes[i];
+
+    if (record.material >= header.materials.count ||
+        record.first_face > header.faces.count ||
+        record.face_count > header.faces.count - record.first_face) {
+      fprintf(stderr, fmt_bad_section, "meshes");
+      return -1;
+    }
+
+    mesh.triangle_ids.clear();
+    mesh.face_storage.clear();
+    mesh.faces = {faces + record.first_face, record.face_count};
+    mesh.material = &scene.materials[record.material];
+  }
+
+  return 0;
+}
+
+/// Sections back to back after the header, each aligned.
+struct Layout {
+  std::vector<std::string_view> parts;
+  u64 size = 0;
+};
+
+static void align(Layout &layout) {
+  static const char zeros[section_alignment] = {};
+  const u64 padding = (section_alignment - layout.size % section_alignment) %
+                      section_alignment;
+
+  layout.parts.push_back({zeros, padding});
+  layout.size += padding;
+}
+
+template <class T>
+static void append(Layout &layout, const T *data, u64 count) {
+  layout.parts.push_back(
+      {reinterpret_cast<const char *>(data), count * sizeof(T)});
+  layout.size += count * sizeof(T);
+}
+
+template <class T>
+static Section add(Layout &layout, const T *data, u64 count) {
+  align(layout);
+  const Section section = {layout.size, count};
+  append(layout, data, count);
+  return section;
+}
+
+int write(const Scene &scene, const std::filesystem::path &path) {
+  Header header;
+  memset(&header, 0, sizeof(header));
+
+  memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.byte_order_mark = byte_order_mark;
+  header.max_ray_trace_depth = scene.max_ray_trace_depth;
+  header.bg_color = scene.bg_color;
+
+  const Camera &cam = scene.cam;
+  header.cam = {
+      .pos = cam.pos,
+      .gaze = cam.gaze,
+      .up = cam.up,
+      .near_plane = cam.near_plane,
+      .near_dist = cam.near_dist,
+      .resolution = cam.resolution,
+  };
+
+  std::vector<MaterialRecord> materials;
+  for (const Material &material : scene.materials) {
+    materials.push_back({
+        .ambient = material.ambient,
+        .diffuse = material.diffuse,
+        .specular = material.specular,
+        .phong = material.phong,
+        .reflectance = material.reflectance,
+    });
+  }
+
+  std::vector<MeshRecord> meshes;
+  std::vector<u32> indices;
+  u64 face_count = 0;
+
+  for (const Mesh &mesh : scene.meshes) {
+    if (mesh.triangle_ids.size() != mesh.faces.size * 3) {
+      fprintf(stderr, "Mesh without triangle ids can't be written\n");
+      return -1;
+    }
+
+    meshes.push_back({
+        .material = static_cast<u32>(mesh.material - scene.materials.data()),
+        .reserved = 0,
+        .first_face = face_count,
+        .face_count = mesh.faces.size,
+    });
+    face_count += mesh.faces.size;
+
+    for (u32 id : mesh.triangle_ids)
+      indices.push_back(id - 1);
+  }
+
+  Layout layout;
+  append(layout, &header, 1);
+
+  header.ambient_lights = add(layout, scene.ambient_lights.data(),
+                              scene.ambient_lights.size());
+  header.point_lights =
+      add(layout, scene.point_lights.data(), scene.point_lights.size());
+  header.materials = add(layout, materials.data(), materials.size());
+  header.vertices =
+      add(layout, scene.vertices.data, scene.vertices.size);
+  header.meshes = add(layout, meshes.data(), meshes.size());
+  header.indices = add(layout, indices.data(), indices.size());
+
+  // NOTE: faces of every mesh form one array, in mesh order
+  align(layout);
+  header.faces = {layout.size, face_count};
+  for (const Mesh &mesh : scene.meshes)
+    append(layout, mesh.faces.data, mesh.faces.size);
+
+  header.file_size = layout.size;
+  return file::write(path, layout.parts);
+}
+
+} // namespace binary
@@ -0,0 +1,83 @@
+#pragma once
+
+/// Versioned binary scene format. Geometry is stored as aligned arrays in
+/// the layout the renderer traces, so a mapped file is used in place and
+/// loading only reads the few small tables.
+///
+/// Layout: Header, then each section at an offset aligned to
+/// section_alignment, in header order. All values are native endian, which
+/// the header records.
+
+#include "scene.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+
+#include <filesystem>
+
+namespace binary {
+
+constexpr char magic[8] = {'R', 'R', 'S', 'C', 'E', 'N', 'E', 0};
+constexpr u32 version = 1;
+constexpr u32 byte_order_mark = 0x01020304;
+constexpr u32 section_alignment = 64;
+
+/// Where an array is in the file.
+struct Section {
+  u64 offset;
+  u64 count;
+};
+
+struct CameraRecord {
+  V3 pos;
+  V3 gaze;
+  V3 up;
+  V4 near_plane;
+  f32 near_dist;
+  V2u resolution;
+};
+
+struct MaterialRecord {
+  V3 ambient;
+  V3 diffuse;
+  V3 specular;
+  f32 phong;
+  V3 reflectance;
+};
+
+struct MeshRecord {
+  u32 material;   // index into materials
+  u32 reserved;
+  u64 first_face; // faces of the mesh follow, also 3 indices per face
+  u64 face_count;
+};
+
+struct Header {
+  char magic[8];
+  u32 version;
+  u32 byte_order_mark;
+  u64 file_size;
+
+  u32 max_ray_trace_depth;
+  V3 bg_color;
+  CameraRecord cam;
+
+  Section ambient_lights; // AmbientLight
+  Section point_lights;   // PointLight
+  Section materials;      // MaterialRecord
+  Section vertices;       // V3
+  Section meshes;         // MeshRecord
+  Section indices;        // u32, 0 indexed vertex ids of faces
+  Section faces;          // TriangleFace
+};
+
+/// True if data starts like a binary scene file.
+bool is_binary(const char *data, umax size);
+
+/// Loads the scene from a file in memory, its vertices and faces point into
+/// data, which must outlive the scene.
+int to_scene(Scene &scene, const char *data, umax size);
+
+/// Writes a parsed scene, its meshes need their triangle ids.
+int write(const Scene &scene, const std::filesystem::path &path);
+
+} // namespace binary
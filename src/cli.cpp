@@ -0,0 +1,334 @@
+#include "cli.hpp"
+#include "str.hpp"
+#include "tile.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+#include <thread>
+
+namespace cli {
+
+constexpr const char *fmt_missing_value = "Option '%s' needs a value!\n";
+
+constexpr const char *fmt_bad_value = "Bad value '%s' for option '%s'!\n";
+
+constexpr const char *usage =
+    "Usage: rrtracer <scene.xml> <output.ppm> [options]\n"
+    "  scene is XML or binary from rrscene, told apart by content\n"
+    "  output - is stdout, which streams the frames like --frames\n"
+    "  --light-error <f>  max total error a hit may take from skipped\n"
+    "                     lights, in output steps (default 0.5)\n"
+    "  -j, --threads <n>  render threads (default hardware concurrency)\n"
+    "  --tile-size <n>    tile edge in pixels (default 32)\n"
+    "  --numa             pin workers per NUMA node, keep their tiles local\n"
+    "  --numa-replicate   --numa with a scene copy on every node\n"
+    "  --deadline <ms>    render progressively, stop refining <ms> after\n"
+    "                     start and fill the rest from coarser pixels; the\n"
+    "                     coarse first pass always completes, so it can run\n"
+    "                     past <ms>. Not for pfm or rgb24 output, which\n"
+    "                     have no place to record the traced pixel count\n"
+    "  --crop <x0> <y0> <x1> <y1>\n"
+    "                     render only pixels in [x0, x1) x [y0, y1)\n"
+    "  --tiles <ids>      render only these tiles, comma separated ids in\n"
+    "                     row major order of --tile-size tiles\n"
+    "  --patch            write rendered region into the existing output\n"
+    "                     image instead of a cropped one\n"
+    "  --prepass          time a coarse pass per tile first, then schedule\n"
+    "                     the costliest tiles first\n"
+    "  --format <name>    output image format, p6 binary PPM, p3 ASCII PPM,\n"
+    "                     rgb24 raw rows, png, or unclamped pfm and hdr\n"
+    "                     (Radiance RGBE)\n"
+    "                     (default from the output extension, else p6)\n"
+    "  --tonemap <name>   8 bit output mapping, linear clamp (default),\n"
+    "                     reinhard or gamma\n"
+    "  --framebuffer <name>\n"
+    "                     pixel storage while rendering, rgb32f (default),\n"
+    "                     rgb8 for 8 bit outputs, rgbe or half for pfm and\n"
+    "                     hdr\n"
+    "  --mmap             write tiles straight into the memory mapped output\n"
+    "                     file, for p6 or pfm frames larger than memory\n"
+    "  --frames <n>       stream n p6 or rgb24 frames of a turntable around\n"
+    "                     the scene back to back, into a pipe for a video\n"
+    "                     encoder; a frame is written while the next traces\n";
+
+template <class T>
+static int option_values(T *vals, u32 count, int &i, int argc, char *argv[]) {
+  const char *name = argv[i];
+
+  if (i + static_cast<int>(count) >= argc) {
+    fprintf(stderr, fmt_missing_value, name);
+    return -1;
+  }
+
+  for (u32 vi = 0; vi < count; ++vi) {
+    const char *str = argv[++i];
+
+    if (str::to_integral(vals[vi], str) < 0) {
+      fprintf(stderr, fmt_bad_value, str, name);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+template <class T>
+static int option_value(T &val, int &i, int argc, char *argv[]) {
+  return option_values(&val, 1, i, argc, argv);
+}
+
+static int option_list(std::vector<u32> &list, int &i, int argc,
+                       char *argv[]) {
+  const char *name = argv[i];
+
+  if (i + 1 >= argc) {
+    fprintf(stderr, fmt_missing_value, name);
+    return -1;
+  }
+
+  std::string str = argv[++i];
+  for (char &c : str) {
+    if (c == ',')
+      c = ' ';
+  }
+
+  if (str::to_array(list, str.c_str(), str.size()) < 0 || list.empty()) {
+    fprintf(stderr, fmt_bad_value, argv[i], name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int option_format(img::Format &format, int &i, int argc,
+                         char *argv[]) {
+  const char *name = argv[i];
+
+  if (i + 1 >= argc) {
+    fprintf(stderr, fmt_missing_value, name);
+    return -1;
+  }
+
+  const char *str = argv[++i];
+
+  if (strcmp(str, "p6") == 0) {
+    format = img::Format::p6;
+  } else if (strcmp(str, "p3") == 0) {
+    format = img::Format::p3;
+  } else if (strcmp(str, "rgb24") == 0) {
+    format = img::Format::rgb24;
+  } else if (strcmp(str, "png") == 0) {
+    format = img::Format::png;
+  } else if (strcmp(str, "pfm") == 0) {
+    format = img::Format::pfm;
+  } else if (strcmp(str, "hdr") == 0) {
+    format = img::Format::rgbe;
+  } else {
+    fprintf(stderr, fmt_bad_value, str, name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int option_tonemap(tonemap::Operator &op, int &i, int argc,
+                          char *argv[]) {
+  const char *name = argv[i];
+
+  if (i + 1 >= argc) {
+    fprintf(stderr, fmt_missing_value, name);
+    return -1;
+  }
+
+  const char *str = argv[++i];
+
+  if (strcmp(str, "linear") == 0) {
+    op = tonemap::Operator::linear;
+  } else if (strcmp(str, "reinhard") == 0) {
+    op = tonemap::Operator::reinhard;
+  } else if (strcmp(str, "gamma") == 0) {
+    op = tonemap::Operator::gamma;
+  } else {
+    fprintf(stderr, fmt_bad_value, str, name);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int option_framebuffer(pixel::Format &format, int &i, int argc,
+                              char *argv[]) {
+  const char *name = argv[i];
+
+  if (i + 1 >= argc) {
+    fprintf(stderr, fmt_missing_value, name);
+    return -1;
+  }
+
+  const char *str = argv[++i];
+
+  if (strcmp(str, "rgb32f") == 0) {
+    format = pixel::Format::rgb32f;
+  } else if (strcmp(str, "rgb8") == 0) {
+    format = pixel::Format::rgb8;
+  } else if (strcmp(str, "rgbe") == 0) {
+    format = pixel::Format::rgbe;
+  } else if (strcmp(str, "half") == 0) {
+    format = pixel::Format::half;
+  } else {
+    fprintf(stderr, fmt_bad_value, str, name);
+    return -1;
+  }
+
+  return 0;
+}
+
+int parse(Options &opts, int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "No XML scene path is given as 1st argument!\n");
+    return -1;
+  } else if (argc < 3) {
+    fprintf(stderr, "No output image path is given as 2nd argument!\n");
+    return -1;
+  }
+
+  opts.scene_path = argv[1];
+  opts.output_path = argv[2];
+  opts.threads = std::thread::hardware_concurrency();
+  opts.tile_size = tile::default_size;
+
+  const char *ext = strrchr(opts.output_path, '.');
+  if (ext && strcasecmp(ext, ".png") == 0)
+    opts.format = img::Format::png;
+  else if (ext && strcasecmp(ext, ".pfm") == 0)
+    opts.format = img::Format::pfm;
+  else if (ext && strcasecmp(ext, ".hdr") == 0)
+    opts.format = img::Format::rgbe;
+  else if (ext && strcasecmp(ext, ".rgb") == 0)
+    opts.format = img::Format::rgb24;
+
+  opts.stream = strcmp(opts.output_path, "-") == 0;
+
+  if (opts.threads == 0)
+    opts.threads = 1;
+
+  for (int i = 3; i < argc; ++i) {
+    int status = 0;
+
+    if (strcmp(argv[i], "--light-error") == 0) {
+      status = option_value(opts.light_error, i, argc, argv);
+    } else if (strcmp(argv[i], "-j") == 0 ||
+               strcmp(argv[i], "--threads") == 0) {
+      status = option_value(opts.threads, i, argc, argv);
+      if (status == 0 && opts.threads == 0) {
+        fprintf(stderr, fmt_bad_value, argv[i], argv[i - 1]);
+        status = -1;
+      }
+    } else if (strcmp(argv[i], "--tile-size") == 0) {
+      status = option_value(opts.tile_size, i, argc, argv);
+    } else if (strcmp(argv[i], "--numa") == 0) {
+      opts.numa = true;
+    } else if (strcmp(argv[i], "--numa-replicate") == 0) {
+      opts.numa = true;
+      opts.numa_replicate = true;
+    } else if (strcmp(argv[i], "--deadline") == 0) {
+      status = option_value(opts.deadline_ms, i, argc, argv);
+    } else if (strcmp(argv[i], "--crop") == 0) {
+      u32 rect[4];
+      opts.crop = true;
+      status = option_values(rect, 4, i, argc, argv);
+      opts.crop_rect.beg = v2u(rect[0], rect[1]);
+      opts.crop_rect.end = v2u(rect[2], rect[3]);
+    } else if (strcmp(argv[i], "--tiles") == 0) {
+      status = option_list(opts.tile_ids, i, argc, argv);
+    } else if (strcmp(argv[i], "--patch") == 0) {
+      opts.patch = true;
+    } else if (strcmp(argv[i], "--prepass") == 0) {
+      opts.prepass = true;
+    } else if (strcmp(argv[i], "--format") == 0) {
+      status = option_format(opts.format, i, argc, argv);
+    } else if (strcmp(argv[i], "--mmap") == 0) {
+      opts.mmap = true;
+    } else if (strcmp(argv[i], "--tonemap") == 0) {
+      status = option_tonemap(opts.tonemap, i, argc, argv);
+    } else if (strcmp(argv[i], "--framebuffer") == 0) {
+      status = option_framebuffer(opts.framebuffer, i, argc, argv);
+    } else if (strcmp(argv[i], "--frames") == 0) {
+      opts.stream = true;
+      status = option_value(opts.frames, i, argc, argv);
+      if (status == 0 && opts.frames == 0) {
+        fprintf(stderr, fmt_bad_value, argv[i], argv[i - 1]);
+        status = -1;
+      }
+    } else {
+      fprintf(stderr, "Unknown option '%s'!\n%s", argv[i], usage);
+      return -1;
+    }
+
+    if (status < 0)
+      return status;
+  }
+
+  if (opts.patch && opts.format != img::Format::p6 &&
+      opts.format != img::Format::p3) {
+    fprintf(stderr, "--patch needs a PPM output image!\n");
+    return -1;
+  }
+
+  // NOTE: patching reads the old image back as render values
+  if (opts.patch && opts.tonemap != tonemap::Operator::linear) {
+    fprintf(stderr, "--patch can't be combined with --tonemap!\n");
+    return -1;
+  }
+
+  if (opts.mmap && ((opts.format != img::Format::p6 &&
+                     opts.format != img::Format::pfm) ||
+                    opts.deadline_ms > 0 || opts.prepass || opts.patch ||
+                    opts.crop || !opts.tile_ids.empty())) {
+    fprintf(stderr, "--mmap takes a full frame in p6 or pfm, without "
+                    "--deadline, --prepass, --patch, --crop or --tiles!\n");
+    return -1;
+  }
+
+  // NOTE: rgb8 keeps tonemapped output steps, rgbe and half keep the
+  // unclamped range only HDR outputs need
+  if (opts.framebuffer != pixel::Format::rgb32f &&
+      (opts.framebuffer == pixel::Format::rgb8) == img::is_hdr(opts.format)) {
+    fprintf(stderr, "--framebuffer rgb8 is for 8 bit outputs, rgbe and half "
+                    "for pfm and hdr!\n");
+    return -1;
+  }
+
+  if (opts.mmap && opts.framebuffer != pixel::Format::rgb32f) {
+    fprintf(stderr, "--mmap can't be combined with --framebuffer!\n");
+    return -1;
+  }
+
+  if (opts.stream && ((opts.format != img::Format::p6 &&
+                       opts.format != img::Format::rgb24) ||
+                      opts.deadline_ms > 0 || opts.patch || opts.mmap)) {
+    fprintf(stderr, "Streamed frames are p6 or rgb24, without --deadline, "
+                    "--patch or --mmap!\n");
+    return -1;
+  }
+
+  if (opts.deadline_ms > 0 && (opts.crop || !opts.tile_ids.empty())) {
+    fprintf(stderr, "--deadline can't be combined with --crop or --tiles!\n");
+    return -1;
+  }
+
+  // NOTE: the traced pixel count goes into the header, pfm and headerless
+  // rgb24 have no place for it
+  if (opts.deadline_ms > 0 && (opts.format == img::Format::pfm ||
+                               opts.format == img::Format::rgb24)) {
+    fprintf(stderr, "--deadline needs p6, p3, png or hdr output!\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+} // namespace cli
@@ -0,0 +1,45 @@
+#pragma once
+
+/// Command line options of the renderer.
+
+#include "img.hpp"
+#include "tile.hpp"
+#include "types.hpp"
+
+#include <vector>
+
+namespace cli {
+
+struct Options {
+  const char *scene_path;
+  const char *output_path;
+
+  f32 light_error = 0.5f;
+  u32 threads; // hardware concurrency unless given
+  u32 tile_size;
+  bool numa = false;           // pin workers per node, first touch tiles
+  bool numa_replicate = false; // copy scene data to every node
+  u32 deadline_ms = 0;         // progressive mode budget since start
+
+  bool crop = false;
+  tile::Tile crop_rect;      // pixels, end exclusive
+  std::vector<u32> tile_ids; // render only these tiles if not empty
+  bool patch = false;        // update region in existing output image
+
+  bool prepass = false; // deal tiles by cost measured on a coarse pass
+
+  img::Format format = img::Format::p6;
+  tonemap::Operator tonemap = tonemap::Operator::linear;
+  pixel::Format framebuffer = pixel::Format::rgb32f;
+  bool mmap = false; // trace straight into the mapped output file
+
+  // NOTE: a stream takes p6 or rgb24 frames of a turntable around the scene
+  // center, output path "-" is stdout
+  bool stream = false;
+  u32 frames = 1;
+};
+
+/// Usage: rrtracer <scene.xml> <output.ppm> [options]
+int parse(Options &opts, int argc, char *argv[]);
+
+} // namespace cli
@@ -1,6 +1,78 @@
 #include "file.hpp"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+int file::map(Mapping &mapping, const std::filesystem::path path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Failed to open file %s : %s\n", path.c_str(),
+            strerror(errno));
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    fprintf(stderr, "Failed to read file size of file %s : %s\n",
+            path.c_str(), strerror(errno));
+    ::close(fd);
+    return -1;
+  }
+
+  // NOTE: an anonymous zero mapping one page longer than the file is
+  // reserved first and the file is mapped over its start, the tail of the
+  // last file page and the page after it read as zero
+  const umax page = sysconf(_SC_PAGESIZE);
+  const umax size = st.st_size;
+  const umax mapped_size = (size + page - 1) / page * page + page;
+
+  void *data = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (data != MAP_FAILED && size > 0 &&
+      mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd,
+           0) == MAP_FAILED) {
+    munmap(data, mapped_size);
+    data = MAP_FAILED;
+  }
+
+  ::close(fd);
+
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Failed to map file %s : %s\n", path.c_str(),
+            strerror(errno));
+    return -1;
+  }
+
+  madvise(data, mapped_size, MADV_SEQUENTIAL);
+
+  mapping.data = static_cast<char *>(data);
+  mapping.size = size;
+  mapping.mapped_size = mapped_size;
+  return 0;
+}
+
+int file::unmap(Mapping &mapping) {
+  if (!mapping.data)
+    return 0;
+
+  const int status = munmap(mapping.data, mapping.mapped_size);
+  mapping = {};
+  return status;
+}
+
+void file::prefetch(Mapping &mapping) {
+  madvise(mapping.data, mapping.mapped_size, MADV_NORMAL);
+  madvise(mapping.data, mapping.mapped_size, MADV_WILLNEED);
+}
 
 int file::read(char *&out, const std::filesystem::path path, umax size) {
   int status = 0;
@@ -9,12 +81,14 @@ int file::read(char *&out, const std::filesystem::path path, umax size) {
   if (!fp) {
     fprintf(stderr, "Failed to open file %s\n", path.c_str());
     status = -1;
-  } else if (std::fread(out, 1, size, fp) != size) {
-    fprintf(stderr, "Failed to read file %s\n", path.c_str());
-    status = -1;
-  }
+  } else {
+    if (std::fread(out, 1, size, fp) != size) {
+      fprintf(stderr, "Failed to read file %s\n", path.c_str());
+      status = -1;
+    }
 
-  std::fclose(fp);
+    std::fclose(fp);
+  }
 
   return status;
 }
@@ -30,3 +104,106 @@ int file::size(umax &size, std::filesystem::path path) {
 
   return 0;
 }
+
+int file::create(const std::filesystem::path path) {
+  int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    fprintf(stderr, "Failed to open file %s : %s\n", path.c_str(),
+            strerror(errno));
+
+  return fd;
+}
+
+int file::open_write(const std::filesystem::path path) {
+  int fd = ::open(path.c_str(), O_WRONLY);
+  if (fd < 0)
+    fprintf(stderr, "Failed to open file %s : %s\n", path.c_str(),
+            strerror(errno));
+
+  return fd;
+}
+
+int file::write_at(int fd, const char *data, umax size, umax offset,
+                   const char *name) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, offset);
+
+    if (written < 0 && errno == EINTR)
+      continue;
+
+    if (written <= 0) {
+      fprintf(stderr, "Failed to write file %s : %s\n", name,
+              strerror(errno));
+      return -1;
+    }
+
+    data += written;
+    size -= written;
+    offset += written;
+  }
+
+  return 0;
+}
+
+int file::close(int fd, const char *name) {
+  if (::close(fd) < 0) {
+    fprintf(stderr, "Failed to close file %s : %s\n", name, strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+int file::write(const std::filesystem::path path, const char *data,
+                umax size) {
+  return write(path, {std::string_view(data, size)});
+}
+
+int file::write(const std::filesystem::path path,
+                const std::vector<std::string_view> &parts) {
+  int fd = create(path);
+  if (fd < 0)
+    return -1;
+
+  if (write(fd, parts, path.c_str()) < 0) {
+    ::close(fd);
+    return -1;
+  }
+
+  return close(fd, path.c_str());
+}
+
+int file::write(int fd, const std::vector<std::string_view> &parts,
+                const char *name) {
+  std::vector<iovec> iov;
+  for (std::string_view part : parts) {
+    if (!part.empty())
+      iov.push_back({const_cast<char *>(part.data()), part.size()});
+  }
+
+  // NOTE: one call writes it all for regular files, loop only in case of a
+  // short write, a pipe, or more parts than IOV_MAX
+  for (size_t first = 0; first < iov.size();) {
+    const int count = std::min<size_t>(iov.size() - first, IOV_MAX);
+    ssize_t written = ::writev(fd, &iov[first], count);
+    if (written < 0 && errno == EINTR)
+      continue;
+
+    if (written <= 0) {
+      fprintf(stderr, "Failed to write file %s : %s\n", name,
+              strerror(errno));
+      return -1;
+    }
+
+    for (; first < iov.size() && static_cast<size_t>(written) >= iov[first].iov_len;
+         ++first)
+      written -= iov[first].iov_len;
+
+    if (written > 0) {
+      iov[first].iov_base = static_cast<char *>(iov[first].iov_base) + written;
+      iov[first].iov_len -= written;
+    }
+  }
+
+  return 0;
+}
@@ -3,8 +3,50 @@
 #include "types.hpp"
 
 #include <filesystem>
+#include <string_view>
+#include <vector>
 
 namespace file {
+/// A file mapped copy on write with a zero page after it, so the text is
+/// null terminated and in-situ parsers may write into it.
+struct Mapping {
+  char *data = nullptr;
+  umax size = 0;        // of the file
+  umax mapped_size = 0; // with the terminating page
+};
+
+/// Maps the file for one sequential pass, pages are read in as they're
+/// touched instead of copied up front.
+int map(Mapping &mapping, const std::filesystem::path path);
+int unmap(Mapping &mapping);
+
+/// Starts reading the whole mapping in, for data used repeatedly in place.
+void prefetch(Mapping &mapping);
+
 int read(char *&out, const std::filesystem::path path, umax size);
 int size(umax &size, const std::filesystem::path path);
+
+/// Replaces the file with size bytes of data.
+int write(const std::filesystem::path path, const char *data, umax size);
+
+/// Replaces the file with parts joined in order, in one vectored write.
+int write(const std::filesystem::path path,
+          const std::vector<std::string_view> &parts);
+
+/// Creates or truncates the file for writing, returns its fd or -1.
+int create(const std::filesystem::path path);
+
+/// Opens an existing file for writing in place, returns its fd or -1.
+int open_write(const std::filesystem::path path);
+
+/// Writes size bytes of data at offset of the open fd, name is used in
+/// errors. Writes to disjoint ranges may run from many threads at once.
+int write_at(int fd, const char *data, umax size, umax offset,
+             const char *name);
+
+int close(int fd, const char *name);
+
+/// Writes parts joined in order to the open fd, name is used in errors.
+int write(int fd, const std::vector<std::string_view> &parts,
+          const char *name);
 } // namespace file
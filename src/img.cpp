@@ -1,24 +1,704 @@
 #include "img.hpp"
+#include "file.hpp"
+#include "png.hpp"
+#include "pool.hpp"
+#include "tonemap.hpp"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <fstream>
+#include <limits>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
 
 namespace img {
-  // TODO: refactor to use file utils
+  constexpr u32 rows_per_chunk = 64;
+
+  static std::string header_of(const Input &in) {
+    std::string header = in.format == Format::p6 ? "P6\n" : "P3\n";
+    if (!in.comment.empty())
+      header += "# " + in.comment + '\n';
+
+    header += std::to_string(in.resolution.x) + ' ' +
+              std::to_string(in.resolution.y) + "\n255\n";
+    return header;
+  }
+
+  /// Decimal text of every channel value followed by a space.
+  struct DecimalTable {
+    char text[256][4];
+    u8 length[256];
+  };
+
+  static const DecimalTable &decimal_table() {
+    static const DecimalTable table = [] {
+      DecimalTable table;
+      for (u32 value = 0; value < 256; ++value) {
+        char buffer[8];
+        table.length[value] = snprintf(buffer, sizeof(buffer), "%u ", value);
+        memcpy(table.text[value], buffer, 4);
+      }
+      return table;
+    }();
+
+    return table;
+  }
+
+  static u32 chunk_count_of(const Input &in) {
+    return (in.resolution.y + rows_per_chunk - 1) / rows_per_chunk;
+  }
+
+  /// First pixel of row y of the image.
+  static const u8 *row_of(const Input &in, u32 y) {
+    const u32 stride = in.stride ? in.stride : in.resolution.x;
+    return in.data + static_cast<size_t>(y) * stride * pixel::size_of(in.pixel);
+  }
+
+  /// Views of the rows of data that is already in the file's pixel format,
+  /// bottom to top if is_flipped.
+  static void add_rows(std::vector<std::string_view> &parts, const Input &in,
+                       bool is_flipped = false) {
+    const size_t row_size = in.resolution.x * pixel::size_of(in.pixel);
+
+    for (u32 i = 0; i < in.resolution.y; ++i) {
+      const u32 y = is_flipped ? in.resolution.y - 1 - i : i;
+      parts.push_back({reinterpret_cast<const char *>(row_of(in, y)), row_size});
+    }
+  }
+
+  /// Converts the image into tightly packed 8 bit RGB rows.
+  static void pack(std::vector<u8> &rgb, const Input &in) {
+    const size_t row_size = static_cast<size_t>(in.resolution.x) * 3;
+    rgb.resize(row_size * in.resolution.y);
+
+    pool::parallel_for(chunk_count_of(in), [&](u32 chunk, u32) {
+      const u32 row_beg = chunk * rows_per_chunk;
+      const u32 row_end = std::min(row_beg + rows_per_chunk, in.resolution.y);
+
+      for (u32 y = row_beg; y < row_end; ++y)
+        pixel::to_rgb8(in.pixel, &rgb[y * row_size], row_of(in, y),
+                       in.resolution.x, in.tonemap);
+    });
+  }
+
+  /// Writes count pixels of rgb as P3 text, returns its size.
+  static size_t encode_p3(char *out, const u8 *rgb, size_t count) {
+    const DecimalTable &decimal = decimal_table();
+    char *pos = out;
+
+    // NOTE: each copy takes 4 bytes, a pixel never passes its 12
+    for (size_t i = 0; i < count * 3; i += 3) {
+      for (u32 c = 0; c < 3; ++c) {
+        memcpy(pos, decimal.text[rgb[i + c]], 4);
+        pos += decimal.length[rgb[i + c]];
+      }
+      pos[-1] = '\n';
+    }
+
+    return pos - out;
+  }
+
+  static void encode_p3(std::string &out, const u8 *rgb, size_t count) {
+    out.resize(count * 12);
+    out.resize(encode_p3(out.data(), rgb, count));
+  }
+
+  /// Adds the 8 bit RGB rows of the image to parts, packed into rgb unless
+  /// the pixels are rgb8 already.
+  static void add_rgb8(std::vector<std::string_view> &parts,
+                       std::vector<u8> &rgb, const Input &in) {
+    if (in.pixel == pixel::Format::rgb8) {
+      add_rows(parts, in);
+      return;
+    }
+
+    pack(rgb, in);
+    parts.push_back({reinterpret_cast<const char *>(rgb.data()), rgb.size()});
+  }
+
   int write_to_ppm(Input in) {
-    std::ofstream fs(in.output_path);
+    const std::string header = header_of(in);
+    std::vector<std::string_view> parts = {header};
+    std::vector<u8> rgb;
+
+    if (in.format == Format::p6) {
+      add_rgb8(parts, rgb, in);
+      return file::write(in.output_path, parts);
+    }
+
+    pack(rgb, in);
+
+    // NOTE: row chunks are formatted in parallel, then gathered in order by
+    // one vectored write
+    const size_t row_size = static_cast<size_t>(in.resolution.x) * 3;
+    std::vector<std::string> chunks(chunk_count_of(in));
+
+    pool::parallel_for(chunks.size(), [&](u32 chunk, u32) {
+      const u32 row_beg = chunk * rows_per_chunk;
+      const u32 row_end = std::min(row_beg + rows_per_chunk, in.resolution.y);
+
+      encode_p3(chunks[chunk], &rgb[row_beg * row_size],
+                static_cast<size_t>(row_end - row_beg) * in.resolution.x);
+    });
+
+    for (const std::string &chunk : chunks)
+      parts.push_back(chunk);
+
+    return file::write(in.output_path, parts);
+  }
+
+  /// Converts the image into tightly packed float rows.
+  static void unpack(std::vector<V3> &colors, const Input &in) {
+    colors.resize(static_cast<size_t>(in.resolution.x) * in.resolution.y);
+
+    pool::parallel_for(chunk_count_of(in), [&](u32 chunk, u32) {
+      const u32 row_beg = chunk * rows_per_chunk;
+      const u32 row_end = std::min(row_beg + rows_per_chunk, in.resolution.y);
+
+      for (u32 y = row_beg; y < row_end; ++y)
+        pixel::to_rgb32f(in.pixel, &colors[static_cast<size_t>(y) * in.resolution.x],
+                         row_of(in, y), in.resolution.x);
+    });
+  }
+
+  int write_to_png(Input in) {
+    std::vector<u8> rgb;
+    pack(rgb, in);
+
+    std::vector<std::string> chunks;
+    png::encode(chunks, rgb.data(), in.resolution, in.comment);
+
+    std::vector<std::string_view> parts(chunks.begin(), chunks.end());
+    return file::write(in.output_path, parts);
+  }
+
+  int write_to_pfm(Input in) {
+    static_assert(sizeof(V3) == 3 * sizeof(f32), "PFM rows are V3 arrays");
+
+    const char *scale =
+        __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? "-1.0" : "1.0";
+    const std::string header = "PF\n" + std::to_string(in.resolution.x) + ' ' +
+                               std::to_string(in.resolution.y) + '\n' +
+                               scale + '\n';
+    std::vector<std::string_view> parts = {header};
+    std::vector<V3> colors;
+
+    // NOTE: PFM goes bottom to top, float rows are written straight from
+    // data
+    if (in.pixel != pixel::Format::rgb32f) {
+      unpack(colors, in);
+      in.data = reinterpret_cast<const u8 *>(colors.data());
+      in.stride = in.resolution.x;
+      in.pixel = pixel::Format::rgb32f;
+    }
+
+    add_rows(parts, in, true);
+    return file::write(in.output_path, parts);
+  }
+
+  int write_to_rgbe(Input in) {
+    std::string header = "#?RADIANCE\n";
+    if (!in.comment.empty())
+      header += "# " + in.comment + '\n';
+
+    header += "FORMAT=32-bit_rle_rgbe\n\n-Y " +
+              std::to_string(in.resolution.y) + " +X " +
+              std::to_string(in.resolution.x) + '\n';
+    std::vector<std::string_view> parts = {header};
+    std::vector<u8> pixels;
+
+    // NOTE: flat scanlines, readers take them as uncompressed ones. rgbe
+    // pixels are written straight from data.
+    if (in.pixel != pixel::Format::rgbe) {
+      const u32 width = in.resolution.x;
+      pixels.resize(static_cast<size_t>(width) * in.resolution.y * 4);
+
+      pool::parallel_for(chunk_count_of(in), [&](u32 chunk, u32) {
+        const u32 row_beg = chunk * rows_per_chunk;
+        const u32 row_end = std::min(row_beg + rows_per_chunk, in.resolution.y);
+        std::vector<V3> colors(width);
+
+        for (u32 y = row_beg; y < row_end; ++y) {
+          pixel::to_rgb32f(in.pixel, colors.data(), row_of(in, y), width);
+          for (u32 x = 0; x < width; ++x)
+            pixel::store(pixel::Format::rgbe,
+                         &pixels[(static_cast<size_t>(y) * width + x) * 4],
+                         colors[x], in.tonemap);
+        }
+      });
+
+      in.data = pixels.data();
+      in.stride = in.resolution.x;
+      in.pixel = pixel::Format::rgbe;
+    }
+
+    add_rows(parts, in);
+    return file::write(in.output_path, parts);
+  }
+
+  int write_to_rgb24(Input in) {
+    std::vector<std::string_view> parts;
+    std::vector<u8> rgb;
+
+    add_rgb8(parts, rgb, in);
+    return file::write(in.output_path, parts);
+  }
+
+  int write(Input in) {
+    switch (in.format) {
+    case Format::rgb24:
+      return write_to_rgb24(in);
+    case Format::png:
+      return write_to_png(in);
+    case Format::pfm:
+      return write_to_pfm(in);
+    case Format::rgbe:
+      return write_to_rgbe(in);
+    default:
+      return write_to_ppm(in);
+    }
+  }
+
+  int open(BandWriter &writer, const Input &in, u32 band_height,
+           u32 window) {
+    writer.fd = file::create(in.output_path);
+    if (writer.fd < 0)
+      return -1;
+
+    const std::string header = header_of(in);
+
+    writer.path = in.output_path;
+    writer.resolution = in.resolution;
+    writer.format = in.format;
+    writer.tonemap = in.tonemap;
+    writer.pixel = in.pixel;
+    writer.band_height = band_height;
+    writer.next_band = 0;
+    writer.offset = header.size();
+    writer.header_size = header.size();
+
+    const u32 band_count = (in.resolution.y + band_height - 1) / band_height;
+    writer.encoded.assign(band_count, {});
+    writer.is_encoded.assign(band_count, 0);
+
+    writer.window = window < band_count ? window : band_count;
+    writer.dealt_band = 0;
+    writer.slots.assign(writer.window,
+                        std::vector<u8>(static_cast<size_t>(band_height) *
+                                        in.resolution.x *
+                                        pixel::size_of(in.pixel)));
+    writer.free_slots.resize(writer.window);
+    for (u32 slot = 0; slot < writer.window; ++slot)
+      writer.free_slots[slot] = slot;
+    writer.band_slot.assign(band_count, 0);
+
+    return file::write_at(writer.fd, header.data(), header.size(), 0,
+                          writer.path.c_str());
+  }
+
+  bool start_band(BandWriter &writer, u32 &band, u8 *&pixels) {
+    const u32 band_count = writer.is_encoded.size();
+    std::unique_lock<std::mutex> lock(writer.mutex);
+
+    // NOTE: encoded P3 bands wait for the ones above to get an offset, so
+    // the window bounds those too, and a free slot follows from it. P6 bands
+    // only need a free slot.
+    writer.band_done.wait(lock, [&] {
+      if (writer.dealt_band == band_count)
+        return true;
+
+      if (writer.format == Format::p3)
+        return writer.dealt_band < writer.next_band + writer.window;
+
+      return !writer.free_slots.empty();
+    });
+
+    if (writer.dealt_band == band_count)
+      return false;
+
+    band = writer.dealt_band++;
+    writer.band_slot[band] = writer.free_slots.back();
+    writer.free_slots.pop_back();
+    pixels = writer.slots[writer.band_slot[band]].data();
+
+    return true;
+  }
+
+  int write_band(BandWriter &writer, u32 band, const u8 *data) {
+    const u32 row_beg = band * writer.band_height;
+    u32 row_count = writer.band_height;
+    if (row_beg + row_count > writer.resolution.y)
+      row_count = writer.resolution.y - row_beg;
+
+    const size_t count = static_cast<size_t>(writer.resolution.x) * row_count;
+    std::string encoded;
+
+    // NOTE: rgb8 pixels are the P6 payload already
+    const bool is_payload =
+        writer.format == Format::p6 && writer.pixel == pixel::Format::rgb8;
+
+    if (writer.format == Format::p6 && !is_payload) {
+      encoded.resize(count * 3);
+      pixel::to_rgb8(writer.pixel, reinterpret_cast<u8 *>(encoded.data()),
+                     data, count, writer.tonemap);
+    } else if (writer.format == Format::p3) {
+      std::vector<u8> rgb(count * 3);
+      pixel::to_rgb8(writer.pixel, rgb.data(), data, count, writer.tonemap);
+      encode_p3(encoded, rgb.data(), count);
+    }
+
+    // NOTE: P6 rows have a fixed size, so a band goes straight to its place
+    if (writer.format == Format::p6) {
+      const umax offset = writer.header_size + static_cast<umax>(row_beg) *
+                                                   writer.resolution.x * 3;
+      const char *bytes = is_payload ? reinterpret_cast<const char *>(data)
+                                     : encoded.data();
+      const int status = file::write_at(writer.fd, bytes, count * 3, offset,
+                                        writer.path.c_str());
+      {
+        std::lock_guard<std::mutex> lock(writer.mutex);
+
+        writer.is_encoded[band] = 1;
+        if (writer.window > 0)
+          writer.free_slots.push_back(writer.band_slot[band]);
+
+        while (writer.next_band < writer.is_encoded.size() &&
+               writer.is_encoded[writer.next_band])
+          ++writer.next_band;
+      }
 
-    fs << "P3\n" << in.resolution.x << ' ' << in.resolution.y << "\n255\n";
+      writer.band_done.notify_all();
+      return status;
+    }
+
+    // NOTE: only offsets are handed out under the lock, bands are written
+    // after it is released and may land in any order
+    std::vector<std::pair<std::string, umax>> ready;
+    {
+      std::lock_guard<std::mutex> lock(writer.mutex);
 
-    for(u32 i = 0; i < in.resolution.y; ++i) {
-      for(u32 j = 0; j < in.resolution.x; ++j) {
-	V3 vec = in.data[j + (i * in.resolution.x)];
-	v3u uvec(vec);
+      writer.encoded[band].swap(encoded);
+      writer.is_encoded[band] = 1;
+      if (writer.window > 0)
+        writer.free_slots.push_back(writer.band_slot[band]);
 
-	fs << uvec.r << ' ' << uvec.g << ' ' << uvec.b << '\n';
+      for (; writer.next_band < writer.is_encoded.size() &&
+             writer.is_encoded[writer.next_band];
+           ++writer.next_band) {
+        std::string &next = writer.encoded[writer.next_band];
+        const umax size = next.size();
+        ready.emplace_back(std::move(next), writer.offset);
+        writer.offset += size;
       }
     }
 
+    if (!ready.empty())
+      writer.band_done.notify_all();
+
+    for (const auto &[str, offset] : ready) {
+      if (file::write_at(writer.fd, str.data(), str.size(), offset,
+                         writer.path.c_str()) < 0)
+        return -1;
+    }
+
+    return 0;
+  }
+
+  int close(BandWriter &writer) {
+    int status = 0;
+
+    if (writer.next_band != writer.is_encoded.size()) {
+      fprintf(stderr, "Image is closed with %zu bands unwritten!\n",
+              writer.is_encoded.size() - writer.next_band);
+      status = -1;
+    }
+
+    if (file::close(writer.fd, writer.path.c_str()) < 0)
+      status = -1;
+
+    writer.fd = -1;
+    return status;
+  }
+
+  /// Offset of the first byte of row y in a mapped image.
+  static size_t row_offset(const MappedImage &image, u32 y) {
+    if (image.format == Format::pfm) {
+      // NOTE: PFM goes bottom to top
+      return image.header_size + static_cast<size_t>(image.resolution.y - 1 - y) *
+                                     image.resolution.x * sizeof(V3);
+    }
+
+    return image.header_size + static_cast<size_t>(y) * image.resolution.x * 3;
+  }
+
+  int open(FrameStream &stream, const std::filesystem::path &path) {
+    stream.path = path;
+
+    if (stream.path == "-") {
+      stream.fd = STDOUT_FILENO;
+      return 0;
+    }
+
+    // NOTE: O_TRUNC is ignored for pipes, open blocks until the encoder
+    // opens the other end
+    stream.fd = file::create(stream.path);
+    return stream.fd < 0 ? -1 : 0;
+  }
+
+  int write_frame(FrameStream &stream, const Input &in) {
+    const std::string header = in.format == Format::p6 ? header_of(in) : "";
+    std::vector<std::string_view> parts = {header};
+    std::vector<u8> rgb;
+
+    add_rgb8(parts, rgb, in);
+    return file::write(stream.fd, parts, stream.path.c_str());
+  }
+
+  int close(FrameStream &stream) {
+    if (stream.fd == STDOUT_FILENO || stream.fd < 0)
+      return 0;
+
+    const int status = file::close(stream.fd, stream.path.c_str());
+    stream.fd = -1;
+    return status;
+  }
+
+  int map(MappedImage &image, const Input &in) {
+    if (in.format != Format::p6 && in.format != Format::pfm) {
+      fprintf(stderr, "Only P6 and PFM images can be mapped!\n");
+      return -1;
+    }
+
+    std::string header;
+    if (in.format == Format::pfm) {
+      header = "PF\n" + std::to_string(in.resolution.x) + ' ' +
+               std::to_string(in.resolution.y) + '\n' +
+               (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ? "-1.0" : "1.0") +
+               '\n';
+    } else {
+      header = header_of(in);
+    }
+
+    const size_t pixel_size = in.format == Format::pfm ? sizeof(V3) : 3;
+    image.header_size = header.size();
+    image.size = header.size() + static_cast<size_t>(in.resolution.x) *
+                                     in.resolution.y * pixel_size;
+    image.resolution = in.resolution;
+    image.format = in.format;
+    image.tonemap = in.tonemap;
+
+    image.fd = ::open(in.output_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (image.fd < 0 || ftruncate(image.fd, image.size) < 0) {
+      fprintf(stderr, "Failed to create image %s : %s\n",
+              in.output_path.c_str(), strerror(errno));
+      return -1;
+    }
+
+    void *data =
+        mmap(nullptr, image.size, PROT_READ | PROT_WRITE, MAP_SHARED, image.fd, 0);
+    if (data == MAP_FAILED) {
+      fprintf(stderr, "Failed to map image %s : %s\n", in.output_path.c_str(),
+              strerror(errno));
+      return -1;
+    }
+
+    image.data = static_cast<u8 *>(data);
+    memcpy(image.data, header.data(), header.size());
+
+    return 0;
+  }
+
+  void write_rect(MappedImage &image, V2u beg, V2u end, const V3 *pixels) {
+    const u32 width = end.x - beg.x;
+
+    for (u32 y = beg.y; y < end.y; ++y, pixels += width) {
+      u8 *row = image.data + row_offset(image, y);
+
+      if (image.format == Format::pfm)
+        memcpy(row + beg.x * sizeof(V3), pixels, width * sizeof(V3));
+      else
+        tonemap::pack(row + beg.x * 3, pixels, width, image.tonemap);
+    }
+  }
+
+  void release_rows(MappedImage &image, u32 row_beg, u32 row_end) {
+    const size_t row_size = image.resolution.x *
+                            (image.format == Format::pfm ? sizeof(V3) : 3);
+    const size_t first = row_offset(image, row_beg);
+    const size_t last = row_offset(image, row_end - 1);
+    size_t beg = std::min(first, last);
+    size_t end = std::max(first, last) + row_size;
+
+    // NOTE: only whole pages inside the rows, neighbours may still be written
+    const size_t page = sysconf(_SC_PAGESIZE);
+    beg = (beg + page - 1) / page * page;
+    end = end / page * page;
+    if (beg >= end)
+      return;
+
+    msync(image.data + beg, end - beg, MS_ASYNC);
+    madvise(image.data + beg, end - beg, MADV_DONTNEED);
+  }
+
+  int unmap(MappedImage &image) {
+    int status = 0;
+
+    if (image.data && munmap(image.data, image.size) < 0)
+      status = -1;
+    if (image.fd >= 0 && ::close(image.fd) < 0)
+      status = -1;
+
+    image.data = nullptr;
+    image.fd = -1;
+
+    if (status < 0)
+      fprintf(stderr, "Failed to write mapped image : %s\n", strerror(errno));
+
+    return status;
+  }
+
+  /// Reads the header of a PPM with resolution, leaves fs at the first pixel.
+  static int read_header(std::ifstream &fs, std::string &magic,
+                         V2u resolution, const std::filesystem::path &path) {
+    u32 width, height, max_value;
+
+    if (!fs) {
+      fprintf(stderr, "Failed to open image %s\n", path.c_str());
+      return -1;
+    }
+
+    fs >> magic;
+    while (fs >> std::ws && fs.peek() == '#')
+      fs.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    fs >> width >> height >> max_value;
+
+    if (!fs || (magic != "P3" && magic != "P6") || max_value != 255) {
+      fprintf(stderr, "Unsupported image format in %s\n", path.c_str());
+      return -1;
+    }
+
+    if (width != resolution.x || height != resolution.y) {
+      fprintf(stderr, "Image %s is %ux%u, expected %ux%u!\n", path.c_str(),
+              width, height, resolution.x, resolution.y);
+      return -1;
+    }
+
+    // NOTE: a single whitespace separates the header from the pixels
+    fs.get();
+    return 0;
+  }
+
+  int read_ppm(u8 *data, pixel::Format format, V2u resolution,
+               const std::filesystem::path &path) {
+    std::ifstream fs(path, std::ios::binary);
+    std::string magic;
+
+    if (read_header(fs, magic, resolution, path) < 0)
+      return -1;
+
+    const size_t count = static_cast<size_t>(resolution.x) * resolution.y;
+    const size_t pixel_size = pixel::size_of(format);
+
+    auto store = [&](size_t i, u32 r, u32 g, u32 b) {
+      pixel::store(format, data + i * pixel_size, v3(r, g, b),
+                   tonemap::Operator::linear);
+    };
+
+    if (magic == "P6") {
+      std::vector<unsigned char> bytes(count * 3);
+      fs.read(reinterpret_cast<char *>(bytes.data()), bytes.size());
+
+      for (size_t i = 0; i < count; ++i)
+        store(i, bytes[3 * i], bytes[3 * i + 1], bytes[3 * i + 2]);
+    }
+
+    for (size_t i = 0; magic == "P3" && i < count; ++i) {
+      u32 r, g, b;
+      fs >> r >> g >> b;
+      store(i, r, g, b);
+    }
+
+    if (!fs) {
+      fprintf(stderr, "Failed to read image %s\n", path.c_str());
+      return -1;
+    }
+
     return 0;
   }
+
+  int patch_ppm(const Input &in, const std::vector<tile::Tile> &rects) {
+    std::ifstream fs(in.output_path, std::ios::binary);
+    std::string magic;
+
+    if (read_header(fs, magic, in.resolution, in.output_path) < 0)
+      return -1;
+
+    if (magic != "P6") {
+      fprintf(stderr, "Image %s is not P6, it can't be patched in place!\n",
+              in.output_path.c_str());
+      return -1;
+    }
+
+    const umax header_size = fs.tellg();
+    fs.close();
+
+    // NOTE: neighbouring tiles of a row of tiles are joined, so every image
+    // row of the run is a single write
+    std::vector<tile::Tile> sorted(rects);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const tile::Tile &a, const tile::Tile &b) {
+                return a.beg.y != b.beg.y ? a.beg.y < b.beg.y
+                                          : a.beg.x < b.beg.x;
+              });
+
+    std::vector<tile::Tile> runs;
+    for (const tile::Tile &rect : sorted) {
+      if (!runs.empty() && runs.back().beg.y == rect.beg.y &&
+          runs.back().end.y == rect.end.y && runs.back().end.x == rect.beg.x)
+        runs.back().end.x = rect.end.x;
+      else
+        runs.push_back(rect);
+    }
+
+    const int fd = file::open_write(in.output_path);
+    if (fd < 0)
+      return -1;
+
+    const size_t pixel_size = pixel::size_of(in.pixel);
+    std::atomic<int> status{0};
+
+    pool::parallel_for(runs.size(), [&](u32 run_id, u32) {
+      const tile::Tile &run = runs[run_id];
+      std::string row;
+
+      for (u32 y = run.beg.y; y < run.end.y; ++y) {
+        row.resize(static_cast<size_t>(tile::width(run)) * 3);
+        pixel::to_rgb8(in.pixel, reinterpret_cast<u8 *>(row.data()),
+                       row_of(in, y) + run.beg.x * pixel_size,
+                       tile::width(run), in.tonemap);
+
+        const umax offset =
+            header_size +
+            (static_cast<umax>(y) * in.resolution.x + run.beg.x) * 3;
+        if (file::write_at(fd, row.data(), row.size(), offset,
+                           in.output_path.c_str()) < 0)
+          status = -1;
+      }
+    });
+
+    if (file::close(fd, in.output_path.c_str()) < 0)
+      return -1;
+
+    return status;
+  }
 }
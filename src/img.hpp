@@ -1,16 +1,142 @@
 #pragma once
 
+#include "pixel.hpp"
+#include "tile.hpp"
+#include "tonemap.hpp"
 #include "types.hpp"
 #include "vector.hpp"
+#include <condition_variable>
 #include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace img {
+  enum class Format {
+    p6, // binary PPM
+    p3, // ASCII PPM
+    rgb24, // raw 8 bit RGB rows without header, for video pipes
+    png,
+    pfm,  // float RGB, needs HDR data
+    rgbe, // Radiance .hdr, needs HDR data
+  };
+
+  /// HDR formats take unclamped data where 1 is full white, the others take
+  /// data clamped to 0-255.
+  constexpr bool is_hdr(Format format) {
+    return format == Format::pfm || format == Format::rgbe;
+  }
+
   struct Input {
-    V3 *data;
+    const u8 *data;
     u32 count;
     V2u resolution;
+    u32 stride; // pixels between rows of data, resolution.x if 0
     std::filesystem::path output_path;
+    std::string comment; // written into the header if not empty
+    Format format = Format::p6;
+    tonemap::Operator tonemap = tonemap::Operator::linear; // 8 bit formats
+    pixel::Format pixel = pixel::Format::rgb32f;           // of data
   };
   
   int write_to_ppm(Input input);
+  int write_to_rgb24(Input input);
+  int write_to_png(Input input);
+  int write_to_pfm(Input input);
+  int write_to_rgbe(Input input);
+
+  /// Writes the image in input.format.
+  int write(Input input);
+
+  /// Writes a PPM while bands of rows are finished in any order. P6 bands
+  /// are written at their offset right away. P3 rows vary in length, so a
+  /// band's file offset is known once every band above it is encoded. With
+  /// a window, the writer also owns the pixels of the bands in flight so no
+  /// full framebuffer is needed.
+  struct BandWriter {
+    int fd = -1;
+    std::filesystem::path path;
+    std::mutex mutex;
+    std::condition_variable band_done;
+    V2u resolution;
+    Format format;
+    umax header_size;
+    tonemap::Operator tonemap;
+    pixel::Format pixel;
+    u32 band_height;
+    u32 next_band; // first band without an offset yet
+    umax offset;   // of next_band
+    std::vector<std::string> encoded;
+    std::vector<char> is_encoded;
+
+    u32 window;     // bands in flight, 0 if the caller owns the pixels
+    u32 dealt_band; // first band not handed out by start_band()
+    std::vector<std::vector<u8>> slots;
+    std::vector<u32> free_slots;
+    std::vector<u32> band_slot;
+  };
+
+  /// Writes the header, in.data is not used.
+  int open(BandWriter &writer, const Input &in, u32 band_height,
+           u32 window = 0);
+
+  /// Hands out the next band and the pixels it is traced into, rows are
+  /// resolution.x apart. Blocks until a band of the window is free, for P3
+  /// while window bands are ahead of the first one without an offset.
+  /// Returns false once every band is handed out.
+  bool start_band(BandWriter &writer, u32 &band, u8 *&pixels);
+
+  /// data is the first pixel of the band, rows are resolution.x apart.
+  /// Safe to call from many threads.
+  int write_band(BandWriter &writer, u32 band, const u8 *data);
+
+  int close(BandWriter &writer);
+
+  /// Frames written back to back into a file, stdout or a named pipe, for
+  /// video encoders reading P6 or rgb24 frames.
+  struct FrameStream {
+    int fd = -1;
+    std::filesystem::path path; // "-" is stdout
+  };
+
+  /// Opens path, blocks until a reader opens it if it is a named pipe.
+  int open(FrameStream &stream, const std::filesystem::path &path);
+
+  /// Writes the next frame in in.format, one frame at a time.
+  int write_frame(FrameStream &stream, const Input &in);
+
+  int close(FrameStream &stream);
+
+  /// A P6 or PFM image file mapped into memory, pixels are written straight
+  /// into it and the page cache writes them back.
+  struct MappedImage {
+    int fd = -1;
+    u8 *data = nullptr;
+    size_t size;
+    size_t header_size;
+    V2u resolution;
+    Format format;
+    tonemap::Operator tonemap;
+  };
+
+  /// Creates the file at full size with its header, in.data is not used.
+  int map(MappedImage &image, const Input &in);
+
+  /// Stores the pixels of [beg, end), rows of pixels are end.x - beg.x
+  /// apart. Safe to call from many threads for disjoint rects.
+  void write_rect(MappedImage &image, V2u beg, V2u end, const V3 *pixels);
+
+  /// Starts write back of finished rows and drops them from memory.
+  void release_rows(MappedImage &image, u32 row_beg, u32 row_end);
+
+  int unmap(MappedImage &image);
+
+  /// Reads a P6 or P3 PPM written by write_to_ppm into pixels of format,
+  /// resolution must match the file.
+  int read_ppm(u8 *data, pixel::Format format, V2u resolution,
+               const std::filesystem::path &path);
+
+  /// Writes only the pixels of rects into the P6 image at in.output_path,
+  /// in place. The image must have in.resolution.
+  int patch_ppm(const Input &in, const std::vector<tile::Tile> &rects);
 }
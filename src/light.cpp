@@ -0,0 +1,89 @@
+#include "light.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+
+namespace light {
+
+static u32 build_node(Tree &tree, const std::vector<PointLight> &lights,
+                      u32 beg, u32 end, u32 depth) {
+  const u32 ni = tree.nodes.size();
+  tree.nodes.emplace_back();
+
+  Node node;
+  node.min = lights[tree.order[beg]].pos;
+  node.max = node.min;
+  node.power = 0;
+  node.count = end - beg;
+
+  for (u32 i = beg; i < end; ++i) {
+    const PointLight &light = lights[tree.order[i]];
+    for (int a = 0; a < 3; ++a) {
+      node.min.e[a] = std::min(node.min.e[a], light.pos.e[a]);
+      node.max.e[a] = std::max(node.max.e[a], light.pos.e[a]);
+    }
+    node.power += max3(light.intensity);
+  }
+
+  if (node.count <= leaf_size || depth + 2 >= max_depth) {
+    node.leaf = true;
+    node.beg = beg;
+    tree.nodes[ni] = node;
+    return ni;
+  }
+
+  // NOTE: median split on the widest axis keeps the tree balanced
+  V3 extent = node.max - node.min;
+  int axis = 0;
+  if (extent.y > extent.e[axis])
+    axis = 1;
+  if (extent.z > extent.e[axis])
+    axis = 2;
+
+  const u32 mid = beg + node.count / 2;
+  std::nth_element(tree.order.begin() + beg, tree.order.begin() + mid,
+                   tree.order.begin() + end, [&](u32 a, u32 b) {
+                     return lights[a].pos.e[axis] < lights[b].pos.e[axis];
+                   });
+
+  build_node(tree, lights, beg, mid, depth + 1);
+  node.leaf = false;
+  node.beg = build_node(tree, lights, mid, end, depth + 1);
+  tree.nodes[ni] = node;
+
+  return ni;
+}
+
+int build(Tree &tree, const std::vector<PointLight> &lights, f32 error) {
+  const u32 count = lights.size();
+
+  tree.nodes.clear();
+  tree.order.resize(count);
+  tree.power.resize(count);
+  tree.pos.resize(count);
+
+  if (error < 0) {
+    fprintf(stderr, "Light error can't be negative!\n");
+    return -1;
+  }
+
+  tree.light_error = count > 0 ? error / count : 0;
+
+  if (count == 0)
+    return 0;
+
+  for (u32 i = 0; i < count; ++i)
+    tree.order[i] = i;
+
+  tree.nodes.reserve(2 * (count / leaf_size + 1));
+  build_node(tree, lights, 0, count, 0);
+
+  for (u32 i = 0; i < count; ++i) {
+    tree.power[i] = max3(lights[tree.order[i]].intensity);
+    tree.pos[i] = lights[tree.order[i]].pos;
+  }
+
+  return 0;
+}
+
+} // namespace light
@@ -0,0 +1,102 @@
+#pragma once
+
+/// Bounding hierarchy over point lights, lets shading skip lights that can't
+/// change the output by more than a given error.
+
+#include "scene.hpp"
+#include "vector.hpp"
+
+#include <vector>
+
+namespace light {
+
+constexpr u32 leaf_size = 4;
+constexpr u32 max_depth = 64;
+
+struct Node {
+  V3 min;
+  V3 max;
+  f32 power; // sum of brightest channel of intensities under node
+  u32 count; // light count under node
+  u32 beg;   // leaf: first index into Tree::order, inner: right child
+  bool leaf; // inner nodes have their left child right after them
+};
+
+struct Tree {
+  std::vector<Node> nodes;
+  std::vector<u32> order; // point light indices in leaf order
+  std::vector<f32> power; // brightest channel per light, in leaf order
+  std::vector<V3> pos;    // light positions, in leaf order
+
+  /// A light can be skipped when its bound is below this, sum of all skipped
+  /// contributions then stays below the error given to build().
+  f32 light_error;
+};
+
+int build(Tree &tree, const std::vector<PointLight> &lights, f32 error);
+
+constexpr f32 max3(V3 v) {
+  f32 m = v.x > v.y ? v.x : v.y;
+  return m > v.z ? m : v.z;
+}
+
+inline f32 dist_sqr(const Node &node, Point3 p) {
+  f32 d = 0;
+
+  for (int i = 0; i < 3; ++i) {
+    f32 dd = 0;
+    if (p.e[i] < node.min.e[i])
+      dd = node.min.e[i] - p.e[i];
+    else if (p.e[i] > node.max.e[i])
+      dd = p.e[i] - node.max.e[i];
+    d += dd * dd;
+  }
+
+  return d;
+}
+
+/// Calls fn(light_index) for every light that may contribute more than the
+/// allowed error at pos. scale bounds the reflectance of the surface times
+/// the weight of the hit in the pixel. Returns skipped light count.
+template <class F>
+u32 for_each_visible(const Tree &tree, Point3 pos, f32 scale, F &&fn) {
+  if (tree.nodes.empty())
+    return 0;
+
+  u32 stack[max_depth];
+  u32 stack_size = 0;
+  u32 culled = 0;
+
+  stack[stack_size++] = 0;
+
+  while (stack_size > 0) {
+    const u32 ni = stack[--stack_size];
+    const Node &node = tree.nodes[ni];
+    const f32 d2 = dist_sqr(node, pos);
+
+    // NOTE: d2 == 0 means pos is inside bounds, nothing to say then
+    if (d2 > 0 && scale * node.power < node.count * tree.light_error * d2) {
+      culled += node.count;
+      continue;
+    }
+
+    if (!node.leaf) {
+      stack[stack_size++] = node.beg;
+      stack[stack_size++] = ni + 1;
+      continue;
+    }
+
+    for (u32 i = node.beg; i < node.beg + node.count; ++i) {
+      if (scale * tree.power[i] < tree.light_error * length_sqr(tree.pos[i] - pos)) {
+        ++culled;
+        continue;
+      }
+
+      fn(tree.order[i]);
+    }
+  }
+
+  return culled;
+}
+
+} // namespace light
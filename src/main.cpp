@@ -1,3 +1,5 @@
+#include "binary.hpp"
+#include "cli.hpp"
 #include "file.hpp"
 #include "rapidxml/rapidxml.hpp"
 #include "scene.hpp"
@@ -5,97 +7,599 @@
 #include "xml.hpp"
 #include "img.hpp"
 #include "ray.hpp"
+#include "light.hpp"
+#include "numa.hpp"
+#include "pool.hpp"
+#include "progressive.hpp"
+#include "tile.hpp"
+#include "timer.hpp"
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
 
 using namespace rapidxml;
 
-int main(int argc, char *argv[]) {
+/// Bands of tile rows each worker may have in flight when streaming.
+constexpr u32 bands_per_worker = 2;
+
+/// Everything the stages of a render share.
+struct Frame {
+  file::Mapping scene_description; // parsed in place
+
+  Scene scene;
+  light::Tree light_tree;
+  ray::Bound bound;
+
+  std::vector<tile::Tile> tiles;
+  tile::Tile region; // bounds of tiles
+  bool is_partial;   // only some tiles of the image are traced
+  size_t traced_count;
+
+  // NOTE: left untouched when allocated so pages land where they are first
+  // written. Not allocated when the writer holds the bands in flight.
+  std::unique_ptr<u8[]> framebuffer;
+  // NOTE: a stream traces into framebuffer while the frame before is
+  // written from here
+  std::unique_ptr<u8[]> back_buffer;
+
+  Camera start_cam; // of the scene, the turntable turns it per frame
+  V3 pivot;
+
+  progressive::Result progress;
+};
+
+static int read_scene(Frame &frame, const cli::Options &opts) {
+  return file::map(frame.scene_description, opts.scene_path);
+}
+
+static int parse_scene(Frame &frame) {
+  file::Mapping &description = frame.scene_description;
   int status;
-  char *scene_description;
-  umax size_scene_description;
 
-  if(argc < 2) {
-    fprintf(stderr, "No XML scene path is given as 1st argument!\n");
+  // NOTE: a binary scene is traced in place, so its pages are read in
+  // ahead and kept instead of streamed past
+  if (binary::is_binary(description.data, description.size)) {
+    file::prefetch(description);
+    status = binary::to_scene(frame.scene, description.data, description.size);
+  } else {
+    status = xml::to_scene(frame.scene, description.data);
+  }
+
+  if (frame.scene.cam.resolution.x == 0) {
+    fprintf(stderr, "Camera X resolution is 0\n");
     return -1;
   }
-  else if(argc < 3) {
-    fprintf(stderr, "No output image path is given as 2nd argument!\n");
+
+  if (frame.scene.cam.resolution.y == 0) {
+    fprintf(stderr, "Camera Y resolution is 0!\n");
     return -1;
   }
 
-  status = file::size(size_scene_description, argv[1]);
+  return status;
+}
+
+static int split_tiles(Frame &frame, const cli::Options &opts) {
+  const V2u &resolution = frame.scene.cam.resolution;
+  int status = tile::split(frame.tiles, resolution, opts.tile_size);
+
+  if (status == 0 && !opts.tile_ids.empty())
+    status = tile::select(frame.tiles, opts.tile_ids);
   if (status < 0)
     return status;
 
-  // + 1 to null terminate
-  scene_description = static_cast<char *>(malloc(size_scene_description + 1));
-  scene_description[size_scene_description] = 0;
+  if (opts.crop)
+    tile::clip(frame.tiles, opts.crop_rect);
 
-  status = file::read(scene_description, argv[1], size_scene_description);
-  if (status < 0)
-    goto on_err;
+  if (frame.tiles.empty()) {
+    fprintf(stderr, "Nothing to render, selected region is empty!\n");
+    return -1;
+  }
 
-  {
-    Scene scene;
-    status = xml::to_scene(scene, scene_description);
+  frame.is_partial = opts.crop || !opts.tile_ids.empty();
+  frame.region = tile::bounds(frame.tiles);
 
-    if(scene.cam.resolution.x == 0) {
-      fprintf(stderr, "Camera X resolution is 0\n");
-      goto on_err;
-    }
+  frame.traced_count = 0;
+  for (const tile::Tile &tile : frame.tiles)
+    frame.traced_count +=
+        static_cast<size_t>(tile::width(tile)) * tile::height(tile);
+
+  return 0;
+}
+
+/// Traces the frame into the bands the writer holds, at most its window of
+/// bands is resident. sched starts out empty.
+static int render_windowed(Frame &frame, const cli::Options &opts,
+                            std::vector<ray::Input> &ray_in,
+                            img::BandWriter &writer,
+                            std::atomic<u32> *tiles_left,
+                            tile::Scheduler &sched) {
+  const std::vector<tile::Tile> &tiles = frame.tiles;
+  const u32 tiles_x =
+      (frame.scene.cam.resolution.x + opts.tile_size - 1) / opts.tile_size;
+  std::unique_ptr<u8 *[]> band_pixels(new u8 *[writer.is_encoded.size()]);
+  std::atomic<int> status{0};
+
+  // NOTE: a worker deals itself the next band when it finds no tile to take
+  // or steal, so it only waits on the window with its own deque empty and
+  // the bands in flight are still traced by their owners or thieves
+  pool::parallel_for(pool::worker_count(), [&](u32, u32 worker) {
+    for (;;) {
+      u32 tile_id;
 
-    if (scene.cam.resolution.y == 0) {
-      fprintf(stderr, "Camera Y resolution is 0!\n");
-      goto on_err;
+      if (tile::take(sched, worker, tile_id)) {
+        const tile::Tile &tile = tiles[tile_id];
+        const u32 band = tile_id / tiles_x;
+        u8 *pixels = band_pixels[band];
+
+        ray::trace(pixels, &ray_in[worker], tile, tile::pass_count,
+                   v2u(0, band * opts.tile_size));
+
+        if (--tiles_left[band] == 0 &&
+            img::write_band(writer, band, pixels) < 0)
+          status = -1;
+        continue;
+      }
+
+      u32 band;
+      u8 *pixels;
+      if (!img::start_band(writer, band, pixels))
+        break;
+
+      band_pixels[band] = pixels;
+      tile::push(sched, worker, band * tiles_x, (band + 1) * tiles_x);
     }
 
-    // TODO: handle according to HW
-    int thread_count = 16;
+    tile::mark_idle(sched);
+  });
 
-    pthread_t pids[thread_count];
-    int y_step = scene.cam.resolution.y / thread_count;
-    std::vector<Color> colors[thread_count];
+  return status;
+}
 
-    ray::Input ray_in[thread_count];
-    ray::ThreadInput tray_in[thread_count];
+/// Traces the frame, streams finished bands of tile rows into writer if it
+/// is given, or traces tiles straight into mapped if that is given.
+static int render(Frame &frame, const cli::Options &opts,
+                  const numa::Topology &topo, const timespec &start_time,
+                  img::BandWriter *writer, img::MappedImage *mapped) {
+  const u32 thread_count = pool::worker_count();
+  const V2u &resolution = frame.scene.cam.resolution;
+  const std::vector<tile::Tile> &tiles = frame.tiles;
+  const tile::Tile &region = frame.region;
+  const bool is_windowed = writer && writer->window > 0;
+  u8 *framebuffer = frame.framebuffer.get();
+  const size_t pixel_size = pixel::size_of(opts.framebuffer);
+  int status = 0;
 
-    for(int i = 0; i < thread_count; ++i) {
-      ray_in[i].scene = &scene;
-      if(i != thread_count - 1) {
-        ray_in[i].y_range = v2u(i * y_step, i * y_step + y_step);
-      } else {
-        ray_in[i].y_range = v2u(i * y_step, scene.cam.resolution.y);
+  std::vector<ray::Input> ray_in(thread_count);
+  std::vector<Scene> scene_replicas;
+  std::vector<light::Tree> light_tree_replicas;
+  tile::Scheduler sched;
+
+  for (ray::Input &in : ray_in) {
+    in.scene = &frame.scene;
+    in.light_tree = &frame.light_tree;
+    in.bound = &frame.bound;
+    in.stats = {};
+    in.is_hdr = img::is_hdr(opts.format);
+    in.is_clamped =
+        !in.is_hdr && opts.tonemap != tonemap::Operator::reinhard;
+    in.invisible_change = tonemap::invisible_change(opts.tonemap);
+    in.pixel_format = opts.framebuffer;
+    in.tonemap = opts.tonemap;
+  }
+
+  if (opts.numa) {
+    const u32 node_count = topo.nodes.size();
+
+    if (opts.numa_replicate) {
+      scene_replicas.resize(node_count);
+      light_tree_replicas.resize(node_count);
+    }
+
+    status = numa::run_on_nodes(topo, [&](u32 node) {
+      V2u rows = numa::node_rows(topo, node, resolution.y);
+      if (framebuffer) {
+        memset(&framebuffer[static_cast<size_t>(rows.beg) * resolution.x *
+                            pixel_size],
+               0,
+               static_cast<size_t>(rows.end - rows.beg) * resolution.x *
+                   pixel_size);
+      }
+
+      if (opts.numa_replicate) {
+        clone(scene_replicas[node], frame.scene);
+        light_tree_replicas[node] = frame.light_tree;
       }
+    });
 
-      tray_in[i].colors = &colors[i];
-      tray_in[i].in = &ray_in[i];
+    if (status < 0)
+      return status;
 
-      pthread_create(&pids[i], NULL, ray::threaded_trace, &tray_in[i]);
+    for (u32 w = 0; opts.numa_replicate && w < thread_count; ++w) {
+      ray_in[w].scene = &scene_replicas[topo.worker_node[w]];
+      ray_in[w].light_tree = &light_tree_replicas[topo.worker_node[w]];
     }
 
-    std::vector<Color> all_colors;
+    numa::deal(sched, topo, tiles, resolution.y);
+  } else {
+    // NOTE: the windowed path deals bands as the writer hands them out
+    tile::deal(sched, is_windowed ? 0 : tiles.size(), thread_count);
+  }
 
-    for(int i = 0; i < thread_count; ++i) {
-      pthread_join(pids[i], NULL);
-      all_colors.insert(all_colors.end(), colors[i].begin(), colors[i].end());
+  // NOTE: P6 is patched in place after tracing, only P3 is read and
+  // written back whole
+  if (opts.patch && opts.format == img::Format::p3) {
+    status = img::read_ppm(framebuffer, opts.framebuffer, resolution,
+                           opts.output_path);
+    if (status < 0)
+      return status;
+  } else if (frame.is_partial && !opts.patch) {
+    // NOTE: region may have holes when only some tiles are picked, zero
+    // bytes are black in every pixel format
+    for (u32 y = region.beg.y; y < region.end.y; ++y) {
+      u8 *row = &framebuffer[static_cast<size_t>(y) * resolution.x * pixel_size];
+      memset(row + region.beg.x * pixel_size, 0,
+             tile::width(region) * pixel_size);
     }
+  }
+
+  const umax beg_ns = timer::now_ns();
+  bool is_prepassed = false;
+
+  // NOTE: pre-pass traces the coarse interlace pass, its pixels are kept
+  // and the main pass only adds the rest
+  if (opts.prepass && opts.deadline_ms == 0) {
+    std::vector<umax> costs(tiles.size());
+
+    // NOTE: the coarse pass runs from the queues dealt above, so NUMA
+    // tiles are timed on their own node too
+    pool::parallel_for(sched, [&](u32 tile_id, u32 worker) {
+      const umax tile_beg_ns = timer::now_ns();
+      ray::trace(framebuffer, &ray_in[worker], tiles[tile_id], 0);
+      costs[tile_id] = timer::now_ns() - tile_beg_ns;
+    });
 
-    size_t count = all_colors.size();
+    // NOTE: with --numa tiles stay with workers of the node owning their
+    // rows, where their framebuffer pages and replicas live
+    if (opts.numa)
+      numa::deal_by_cost(sched, topo, tiles, resolution.y, costs);
+    else
+      tile::deal_by_cost(sched, costs, thread_count);
+    is_prepassed = true;
+
+    fprintf(stderr, "Pre-pass time: %.3f s\n",
+            timer::seconds(beg_ns, timer::now_ns()));
+  }
+
+  if (opts.deadline_ms > 0) {
+    timespec deadline = start_time;
+    deadline.tv_sec += opts.deadline_ms / 1000;
+    deadline.tv_nsec += (opts.deadline_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
 
-    img::Input img_in {
-      .data = all_colors.data(),
-      .count = static_cast<u32>(count),
-      .resolution = scene.cam.resolution,
-      .output_path = argv[2],
+    progressive::render(framebuffer, ray_in, tiles, resolution,
+                        opts.tile_size, deadline, frame.progress);
+  } else {
+    // NOTE: tiles come from a full split when streaming, so a band is a row
+    // of tiles and its last finished tile hands it to the writer
+    const u32 tiles_x = (resolution.x + opts.tile_size - 1) / opts.tile_size;
+    const u32 band_count = (resolution.y + opts.tile_size - 1) / opts.tile_size;
+    std::unique_ptr<std::atomic<u32>[]> tiles_left(
+        new std::atomic<u32>[band_count]);
+    std::atomic<int> write_status{0};
+
+    for (u32 band = 0; band < band_count; ++band)
+      tiles_left[band] = tiles_x;
+
+    if (is_windowed) {
+      write_status = render_windowed(frame, opts, ray_in, *writer,
+                                     tiles_left.get(), sched);
+    } else if (mapped) {
+      // NOTE: a tile is traced into its worker's scratch, then stored in the
+      // file pages, finished bands are let go so resident memory stays small
+      std::vector<std::vector<Color>> scratch(thread_count);
+
+      pool::parallel_for(sched, [&](u32 tile_id, u32 worker) {
+        const tile::Tile &tile = tiles[tile_id];
+        std::vector<Color> &pixels = scratch[worker];
+
+        pixels.resize(static_cast<size_t>(tile::width(tile)) *
+                      tile::height(tile));
+        ray::trace(pixels.data(), &ray_in[worker], tile, tile::pass_count,
+                   tile.beg, tile::width(tile));
+        img::write_rect(*mapped, tile.beg, tile.end, pixels.data());
+
+        const u32 band = tile.beg.y / opts.tile_size;
+        if (--tiles_left[band] == 0)
+          img::release_rows(*mapped, tile.beg.y, tile.end.y);
+      });
+    } else {
+      pool::parallel_for(sched, [&](u32 tile_id, u32 worker) {
+        const tile::Tile &tile = tiles[tile_id];
+
+        if (!is_prepassed) {
+          ray::trace(framebuffer, &ray_in[worker], tile);
+        } else {
+          for (u32 pass = 1; pass < tile::pass_count; ++pass)
+            ray::trace(framebuffer, &ray_in[worker], tile, pass);
+        }
+
+        const u32 band = tile.beg.y / opts.tile_size;
+        if (writer && --tiles_left[band] == 0) {
+          if (img::write_band(*writer, band,
+                              &framebuffer[static_cast<size_t>(tile.beg.y) *
+                                           resolution.x * pixel_size]) < 0)
+            write_status = -1;
+        }
+      });
+    }
+
+    status = write_status;
+  }
+
+  const umax end_ns = timer::now_ns();
+
+  ray::Stats stats = {};
+  for (const ray::Input &in : ray_in)
+    ray::add(stats, in.stats);
+
+  ray::print(stats);
+  const double render_time = timer::seconds(beg_ns, end_ns);
+  fprintf(stderr, "Render time: %.3f s on %u threads (%.2f Mpixel/s)\n",
+          render_time, thread_count, frame.traced_count * 1e-6 / render_time);
+
+  if (sched.first_idle_ns > 0)
+    fprintf(stderr, "Tail latency: %.3f s\n",
+            timer::seconds(sched.first_idle_ns, end_ns));
+
+  return status;
+}
+
+static img::Input image_of(Frame &frame, const cli::Options &opts) {
+  const V2u &resolution = frame.scene.cam.resolution;
+  const tile::Tile &region = frame.region;
+
+  img::Input img_in {
+    .data = frame.framebuffer.get(),
+    .count = resolution.x * resolution.y,
+    .resolution = resolution,
+    .stride = resolution.x,
+    .output_path = opts.output_path,
+    .comment = {},
+    .format = opts.format,
+    .tonemap = opts.tonemap,
+    .pixel = opts.framebuffer,
+  };
+
+  if (frame.is_partial && !opts.patch) {
+    img_in.data += (static_cast<size_t>(region.beg.y) * resolution.x +
+                    region.beg.x) *
+                   pixel::size_of(opts.framebuffer);
+    img_in.resolution = v2u(tile::width(region), tile::height(region));
+    img_in.count = img_in.resolution.x * img_in.resolution.y;
+  }
+
+  if (opts.deadline_ms > 0) {
+    const progressive::Result &progress = frame.progress;
+    char comment[64];
+    snprintf(comment, sizeof(comment), "traced %ju of %ju pixels (%.2f%%)",
+             progress.traced, progress.total,
+             100.0 * progress.traced / progress.total);
+
+    img_in.comment = comment;
+    fprintf(stderr, "Progressive: %s\n", comment);
+  }
+
+  return img_in;
+}
+
+/// Turns the camera to frame index of the turntable and traces it into the
+/// framebuffer, image is the frame to write.
+static int render_frame(Frame &frame, const cli::Options &opts, u32 index,
+                        const numa::Topology &topo,
+                        const timespec &start_time, img::Input &image) {
+  if (index == 0) {
+    frame.start_cam = frame.scene.cam;
+    frame.pivot = center(frame.scene);
+  } else {
+    std::swap(frame.framebuffer, frame.back_buffer);
+  }
+
+  frame.scene.cam = frame.start_cam;
+  orbit(frame.scene.cam, frame.pivot, 2 * M_PI * index / opts.frames);
+
+  int status = render(frame, opts, topo, start_time, nullptr, nullptr);
+  image = image_of(frame, opts);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  int status;
+  cli::Options opts;
+  timespec start_time;
+
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  const umax start_ns = timer::now_ns();
+
+  status = cli::parse(opts, argc, argv);
+  if (status < 0)
+    return status;
+
+  Frame frame;
+
+  status = pool::init(opts.threads);
+  if (status < 0)
+    return status;
+
+  numa::Topology topo;
+
+  if (opts.numa) {
+    status = numa::read_topology(topo);
+    if (status == 0) {
+      numa::assign_workers(topo, pool::worker_count());
+      status = numa::pin_workers(topo);
+    }
+
+    if (status < 0) {
+      pool::shutdown();
+      return status;
+    }
+
+    fprintf(stderr, "NUMA nodes: %zu\n", topo.nodes.size());
+  }
+
+  // NOTE: stages run as a task graph on the pool, independent ones overlap
+  // and encoding of finished bands overlaps tracing
+  std::atomic<int> graph_status{0};
+  img::BandWriter writer;
+  img::MappedImage mapped;
+  img::FrameStream stream;
+  std::vector<img::Input> frame_images(opts.frames);
+  bool is_streamed = false;
+
+  auto stage = [&](auto fn) {
+    return [&graph_status, fn](u32) {
+      if (graph_status < 0)
+        return;
+
+      int stage_status = fn();
+      if (stage_status < 0)
+        graph_status = stage_status;
     };
+  };
+
+  pool::Graph graph;
+
+  const u32 read_node =
+      pool::add(graph, stage([&] { return read_scene(frame, opts); }));
+
+  const u32 parse_node = pool::add(
+      graph, stage([&] { return parse_scene(frame); }), {read_node});
+
+  const u32 light_node = pool::add(graph, stage([&] {
+    return light::build(frame.light_tree, frame.scene.point_lights,
+                        opts.light_error);
+  }), {parse_node});
+
+  const u32 material_node = pool::add(graph, stage([&] {
+    prepare(frame.scene);
+    return 0;
+  }), {parse_node});
+
+  const u32 bound_node = pool::add(graph, stage([&] {
+    return ray::bound(frame.bound, frame.scene);
+  }), {parse_node});
+
+  const u32 tile_node = pool::add(graph, stage([&] {
+    int tile_status = split_tiles(frame, opts);
+    if (tile_status < 0)
+      return tile_status;
+
+    if (opts.mmap)
+      return img::map(mapped, image_of(frame, opts));
+
+    is_streamed = !opts.stream && opts.deadline_ms == 0 && !frame.is_partial &&
+                  (opts.format == img::Format::p6 ||
+                   opts.format == img::Format::p3);
+
+    // NOTE: NUMA first touch and the pre-pass need the whole framebuffer,
+    // otherwise only the bands in flight are resident
+    const u32 window = is_streamed && !opts.numa && !opts.prepass
+                           ? pool::worker_count() * bands_per_worker
+                           : 0;
+
+    const V2u &resolution = frame.scene.cam.resolution;
+    const size_t framebuffer_size = static_cast<size_t>(resolution.x) *
+                                    resolution.y *
+                                    pixel::size_of(opts.framebuffer);
+
+    if (window == 0)
+      frame.framebuffer.reset(new u8[framebuffer_size]);
+
+    if (opts.stream && opts.frames > 1)
+      frame.back_buffer.reset(new u8[framebuffer_size]);
 
-    img::write_to_ppm(img_in);
+    if (!is_streamed)
+      return 0;
+
+    return img::open(writer, image_of(frame, opts), opts.tile_size, window);
+  }), {parse_node});
+
+  if (opts.stream) {
+    // NOTE: frame i traces once frame i - 2 is written, so writing a frame
+    // overlaps tracing the next one. Opening a pipe waits for its reader,
+    // meanwhile the scene loads.
+    const u32 open_node = pool::add(graph, stage([&] {
+      return img::open(stream, opts.output_path);
+    }));
+
+    u32 render_node = 0;
+    u32 write_node = 0;
+    u32 prev_write_node = 0;
+
+    for (u32 i = 0; i < opts.frames; ++i) {
+      auto render_task = stage([&, i] {
+        return render_frame(frame, opts, i, topo, start_time,
+                            frame_images[i]);
+      });
+      auto write_task = stage([&, i] {
+        return img::write_frame(stream, frame_images[i]);
+      });
+
+      if (i == 0) {
+        render_node = pool::add(graph, render_task,
+                                {light_node, material_node, bound_node,
+                                 tile_node});
+      } else if (i == 1) {
+        render_node = pool::add(graph, render_task, {render_node});
+      } else {
+        render_node =
+            pool::add(graph, render_task, {render_node, prev_write_node});
+      }
+
+      prev_write_node = write_node;
+      write_node = pool::add(graph, write_task,
+                             {render_node, i == 0 ? open_node : write_node});
+    }
+
+    pool::add(graph, stage([&] { return img::close(stream); }),
+              {write_node});
+  } else {
+    const u32 render_node = pool::add(graph, stage([&] {
+      return render(frame, opts, topo, start_time,
+                    is_streamed ? &writer : nullptr,
+                    opts.mmap ? &mapped : nullptr);
+    }), {light_node, material_node, bound_node, tile_node});
+
+    pool::add(graph, stage([&] {
+      if (opts.mmap)
+        return img::unmap(mapped);
+
+      if (is_streamed)
+        return img::close(writer);
+
+      if (opts.patch && opts.format == img::Format::p6)
+        return img::patch_ppm(image_of(frame, opts), frame.tiles);
+
+      return img::write(image_of(frame, opts));
+    }), {render_node});
   }
 
-on_err:
-  free(scene_description);
+  pool::run(graph);
+  status = graph_status;
+
+  fprintf(stderr, "Total time: %.3f s\n",
+          timer::seconds(start_ns, timer::now_ns()));
+
+  pool::shutdown();
+  file::unmap(frame.scene_description);
   return status;
 }
@@ -0,0 +1,257 @@
+#include "numa.hpp"
+#include "pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+
+namespace numa {
+
+constexpr const char *node_dir = "/sys/devices/system/node";
+
+/// Parses lists like "0-3,8,10-11".
+static int parse_list(std::vector<u32> &out, const char *str) {
+  while (*str && *str != '\n') {
+    char *end;
+    long beg = strtol(str, &end, 10);
+    long last = beg;
+
+    if (end == str || beg < 0)
+      return -1;
+
+    if (*end == '-') {
+      str = end + 1;
+      last = strtol(str, &end, 10);
+      if (end == str || last < beg)
+        return -1;
+    }
+
+    for (long i = beg; i <= last; ++i)
+      out.push_back(static_cast<u32>(i));
+
+    str = end;
+    if (*str == ',')
+      ++str;
+  }
+
+  return 0;
+}
+
+static int read_list(std::vector<u32> &out, const char *path) {
+  FILE *fp = fopen(path, "r");
+  char buf[4096];
+
+  if (!fp)
+    return -1;
+
+  bool ok = fgets(buf, sizeof(buf), fp) != nullptr;
+  fclose(fp);
+
+  if (!ok)
+    return -1;
+
+  return parse_list(out, buf);
+}
+
+int read_topology(Topology &topo) {
+  char path[256];
+  std::vector<u32> online;
+
+  topo.nodes.clear();
+
+  snprintf(path, sizeof(path), "%s/online", node_dir);
+  if (read_list(online, path) == 0) {
+    for (u32 id : online) {
+      Node node;
+      node.id = id;
+
+      snprintf(path, sizeof(path), "%s/node%u/cpulist", node_dir, id);
+      if (read_list(node.cpus, path) < 0) {
+        fprintf(stderr, "Failed to read cpu list of NUMA node %u\n", id);
+        return -1;
+      }
+
+      // NOTE: memory only nodes can't run workers
+      if (!node.cpus.empty())
+        topo.nodes.push_back(node);
+    }
+  }
+
+  if (topo.nodes.empty()) {
+    Node node;
+    node.id = 0;
+
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long i = 0; i < cpu_count; ++i)
+      node.cpus.push_back(static_cast<u32>(i));
+
+    topo.nodes.push_back(node);
+  }
+
+  return 0;
+}
+
+void assign_workers(Topology &topo, u32 worker_count) {
+  u32 cpu_count = 0;
+  for (const Node &node : topo.nodes)
+    cpu_count += node.cpus.size();
+
+  topo.worker_node.resize(worker_count);
+
+  u32 worker = 0;
+  u32 cpus_before = 0;
+
+  for (u32 ni = 0; ni < topo.nodes.size(); ++ni) {
+    cpus_before += topo.nodes[ni].cpus.size();
+
+    const u32 end = ni + 1 == topo.nodes.size()
+                        ? worker_count
+                        : static_cast<u32>(static_cast<umax>(worker_count) *
+                                           cpus_before / cpu_count);
+
+    for (; worker < end; ++worker)
+      topo.worker_node[worker] = ni;
+  }
+}
+
+static void to_cpu_set(cpu_set_t &set, const Node &node) {
+  CPU_ZERO(&set);
+  for (u32 cpu : node.cpus) {
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+}
+
+int pin_workers(const Topology &topo) {
+  for (u32 i = 0; i < topo.worker_node.size(); ++i) {
+    cpu_set_t set;
+    to_cpu_set(set, topo.nodes[topo.worker_node[i]]);
+
+    if (pool::pin(i, set) < 0)
+      return -1;
+  }
+
+  return 0;
+}
+
+V2u node_rows(const Topology &topo, u32 node, u32 height) {
+  const umax worker_count = topo.worker_node.size();
+  umax beg = 0;
+  umax end = 0;
+
+  for (u32 w = 0; w < worker_count; ++w) {
+    if (topo.worker_node[w] < node)
+      ++beg;
+    if (topo.worker_node[w] <= node)
+      ++end;
+  }
+
+  return v2u(beg * height / worker_count, end * height / worker_count);
+}
+
+static std::vector<std::vector<u32>> workers_of_nodes(const Topology &topo) {
+  std::vector<std::vector<u32>> node_workers(topo.nodes.size());
+
+  for (u32 w = 0; w < topo.worker_node.size(); ++w)
+    node_workers[topo.worker_node[w]].push_back(w);
+
+  return node_workers;
+}
+
+/// Node owning the rows of tile, nodes without workers are passed over.
+static u32 node_of(const Topology &topo,
+                   const std::vector<std::vector<u32>> &node_workers,
+                   const tile::Tile &tile, u32 height) {
+  u32 node = 0;
+  while (node + 1 < topo.nodes.size() &&
+         (node_workers[node].empty() ||
+          tile.beg.y >= node_rows(topo, node, height).end))
+    ++node;
+
+  return node;
+}
+
+void deal(tile::Scheduler &sched, const Topology &topo,
+          const std::vector<tile::Tile> &tiles, u32 height) {
+  const u32 worker_count = topo.worker_node.size();
+  const std::vector<std::vector<u32>> node_workers = workers_of_nodes(topo);
+  std::vector<u32> next(topo.nodes.size());
+  std::vector<u32> owners(tiles.size());
+
+  for (u32 ti = 0; ti < tiles.size(); ++ti) {
+    const u32 node = node_of(topo, node_workers, tiles[ti], height);
+    const std::vector<u32> &workers = node_workers[node];
+    owners[ti] = workers.empty() ? ti % worker_count
+                                 : workers[next[node]++ % workers.size()];
+  }
+
+  tile::deal(sched, owners, worker_count);
+}
+
+void deal_by_cost(tile::Scheduler &sched, const Topology &topo,
+                  const std::vector<tile::Tile> &tiles, u32 height,
+                  const std::vector<umax> &costs) {
+  const u32 worker_count = topo.worker_node.size();
+  const std::vector<std::vector<u32>> node_workers = workers_of_nodes(topo);
+  std::vector<u32> tile_nodes(tiles.size());
+
+  for (u32 ti = 0; ti < tiles.size(); ++ti) {
+    const u32 node = node_of(topo, node_workers, tiles[ti], height);
+    tile_nodes[ti] = node_workers[node].empty()
+                         ? topo.worker_node[ti % worker_count]
+                         : node;
+  }
+
+  tile::deal_by_cost(sched, costs, tile_nodes, topo.worker_node);
+}
+
+struct NodeTask {
+  const std::function<void(u32)> *fn;
+  u32 node;
+};
+
+static void *run_node_task(void *arg) {
+  NodeTask *task = static_cast<NodeTask *>(arg);
+  (*task->fn)(task->node);
+  return 0;
+}
+
+int run_on_nodes(const Topology &topo, const std::function<void(u32)> &fn) {
+  const u32 count = topo.nodes.size();
+  std::unique_ptr<pthread_t[]> pids(new pthread_t[count]);
+  std::unique_ptr<NodeTask[]> tasks(new NodeTask[count]);
+  int status = 0;
+  u32 started = 0;
+
+  for (; started < count; ++started) {
+    pthread_attr_t attr;
+    cpu_set_t set;
+
+    to_cpu_set(set, topo.nodes[started]);
+    tasks[started] = {&fn, started};
+
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    int err = pthread_create(&pids[started], &attr, run_node_task,
+                             &tasks[started]);
+    pthread_attr_destroy(&attr);
+
+    if (err) {
+      fprintf(stderr, "Failed to start thread on NUMA node %u\n",
+              topo.nodes[started].id);
+      status = -1;
+      break;
+    }
+  }
+
+  for (u32 i = 0; i < started; ++i)
+    pthread_join(pids[i], NULL);
+
+  return status;
+}
+
+} // namespace numa
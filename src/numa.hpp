@@ -0,0 +1,52 @@
+#pragma once
+
+/// NUMA topology read from /sys, no libnuma. Memory is placed by first touch,
+/// so anything that should live on a node is written by a thread pinned
+/// there.
+
+#include "tile.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace numa {
+
+struct Node {
+  u32 id;
+  std::vector<u32> cpus;
+};
+
+struct Topology {
+  std::vector<Node> nodes;
+  std::vector<u32> worker_node; // node index of each pool worker
+};
+
+/// Falls back to a single node holding every online cpu when /sys has no
+/// node information.
+int read_topology(Topology &topo);
+
+/// Spreads workers over nodes in contiguous blocks, sized by cpu count.
+void assign_workers(Topology &topo, u32 worker_count);
+
+/// Pins each pool worker to the cpus of its node.
+int pin_workers(const Topology &topo);
+
+/// Image rows owned by a node, in proportion to its worker count.
+V2u node_rows(const Topology &topo, u32 node, u32 height);
+
+/// Deals every tile round robin to the workers of the node owning its rows.
+void deal(tile::Scheduler &sched, const Topology &topo,
+          const std::vector<tile::Tile> &tiles, u32 height);
+
+/// Deals every tile to the workers of the node owning its rows, costliest
+/// first and balanced by cost within each node.
+void deal_by_cost(tile::Scheduler &sched, const Topology &topo,
+                  const std::vector<tile::Tile> &tiles, u32 height,
+                  const std::vector<umax> &costs);
+
+/// Runs fn(node_index) on a thread pinned to every node concurrently.
+int run_on_nodes(const Topology &topo, const std::function<void(u32)> &fn);
+
+} // namespace numa
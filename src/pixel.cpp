@@ -0,0 +1,145 @@
+#include "pixel.hpp"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace pixel {
+
+/// Pixels converted at a time when going through floats.
+constexpr size_t batch_size = 256;
+
+static u16 to_half(f32 value) {
+  u32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  const u16 sign = (bits >> 16) & 0x8000;
+  bits &= 0x7fffffff;
+
+  if (bits >= 0x7f800000) // inf and NaN
+    return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+  if (bits >= 0x477ff000) // rounds past the largest half
+    return sign | 0x7c00;
+  if (bits < 0x38800000) { // subnormal half, exact in float steps of 2^-24
+    f32 magnitude;
+    memcpy(&magnitude, &bits, sizeof(magnitude));
+    return sign | static_cast<u16>(lrintf(magnitude * 16777216.0f));
+  }
+
+  // NOTE: rounds the dropped 13 bits to nearest even
+  bits += 0x0fff + ((bits >> 13) & 1);
+  return sign | ((bits - 0x38000000) >> 13);
+}
+
+static f32 from_half(u16 half) {
+  const u32 sign = static_cast<u32>(half & 0x8000) << 16;
+  const u32 exponent = (half >> 10) & 0x1f;
+  const u32 mantissa = half & 0x3ff;
+
+  if (exponent == 0) {
+    const f32 magnitude = mantissa * (1.0f / 16777216.0f);
+    return sign ? -magnitude : magnitude;
+  }
+
+  u32 bits = sign | (mantissa << 13);
+  bits |= exponent == 31 ? 0x7f800000 : (exponent + 112) << 23;
+
+  f32 value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static void to_rgbe(u8 *out, const V3 &color) {
+  const f32 max = std::max(color.x, std::max(color.y, color.z));
+
+  if (max < 1e-32f) {
+    memset(out, 0, 4);
+    return;
+  }
+
+  int exponent;
+  const f32 scale = frexpf(max, &exponent) * 256 / max;
+
+  out[0] = static_cast<u8>(std::max(color.x, 0.0f) * scale);
+  out[1] = static_cast<u8>(std::max(color.y, 0.0f) * scale);
+  out[2] = static_cast<u8>(std::max(color.z, 0.0f) * scale);
+  out[3] = static_cast<u8>(exponent + 128);
+}
+
+static V3 from_rgbe(const u8 *in) {
+  if (in[3] == 0)
+    return v3(0, 0, 0);
+
+  // NOTE: + 0.5 puts the value in the middle of its step like Radiance
+  const f32 scale = ldexpf(1, in[3] - (128 + 8));
+  return v3((in[0] + 0.5f) * scale, (in[1] + 0.5f) * scale,
+            (in[2] + 0.5f) * scale);
+}
+
+void store(Format format, u8 *out, const V3 &color, tonemap::Operator op) {
+  switch (format) {
+  case Format::rgb32f:
+    memcpy(out, &color, sizeof(V3));
+    break;
+  case Format::rgb8:
+    tonemap::pack(out, &color, 1, op);
+    break;
+  case Format::rgbe:
+    to_rgbe(out, color);
+    break;
+  case Format::half:
+    for (int c = 0; c < 3; ++c) {
+      const u16 half = to_half(color.e[c]);
+      memcpy(out + c * sizeof(half), &half, sizeof(half));
+    }
+    break;
+  }
+}
+
+void to_rgb32f(Format format, V3 *out, const u8 *in, size_t count) {
+  const u32 size = size_of(format);
+
+  for (size_t i = 0; i < count; ++i, in += size) {
+    switch (format) {
+    case Format::rgb32f:
+      memcpy(&out[i], in, sizeof(V3));
+      break;
+    case Format::rgb8:
+      out[i] = v3(in[0], in[1], in[2]);
+      break;
+    case Format::rgbe:
+      out[i] = from_rgbe(in);
+      break;
+    case Format::half:
+      for (int c = 0; c < 3; ++c) {
+        u16 half;
+        memcpy(&half, in + c * sizeof(half), sizeof(half));
+        out[i].e[c] = from_half(half);
+      }
+      break;
+    }
+  }
+}
+
+void to_rgb8(Format format, u8 *out, const u8 *in, size_t count,
+             tonemap::Operator op) {
+  if (format == Format::rgb8) {
+    memcpy(out, in, count * 3);
+    return;
+  }
+
+  if (format == Format::rgb32f) {
+    tonemap::pack(out, reinterpret_cast<const V3 *>(in), count, op);
+    return;
+  }
+
+  V3 colors[batch_size];
+  for (size_t beg = 0; beg < count; beg += batch_size) {
+    const size_t n = std::min(batch_size, count - beg);
+    to_rgb32f(format, colors, in + beg * size_of(format), n);
+    tonemap::pack(out + beg * 3, colors, n, op);
+  }
+}
+
+} // namespace pixel
@@ -0,0 +1,45 @@
+#pragma once
+
+/// Storage formats of framebuffer pixels. Colors are converted as a pixel is
+/// stored, so the compact ones cut framebuffer memory and the bandwidth of
+/// the output stage.
+
+#include "tonemap.hpp"
+#include "types.hpp"
+#include "vector.hpp"
+
+#include <stddef.h>
+
+namespace pixel {
+
+enum class Format {
+  rgb32f, // 3 floats
+  rgb8,   // tonemapped 8 bit RGB, for 8 bit output only
+  rgbe,   // Radiance shared exponent, for HDR output only
+  half,   // 3 half floats, for HDR output only
+};
+
+constexpr u32 size_of(Format format) {
+  switch (format) {
+  case Format::rgb8:
+    return 3;
+  case Format::rgbe:
+    return 4;
+  case Format::half:
+    return 6;
+  default:
+    return 12;
+  }
+}
+
+/// Stores color at out, op maps it to 8 bits for rgb8.
+void store(Format format, u8 *out, const V3 &color, tonemap::Operator op);
+
+/// Converts count pixels at in to 8 bit RGB.
+void to_rgb8(Format format, u8 *out, const u8 *in, size_t count,
+             tonemap::Operator op);
+
+/// Converts count pixels at in to float RGB.
+void to_rgb32f(Format format, V3 *out, const u8 *in, size_t count);
+
+} // namespace pixel
@@ -0,0 +1,651 @@
+#include "png.hpp"
+#include "pool.hpp"
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+namespace png {
+
+constexpr u32 rows_per_chunk = 64;      // scanlines filtered per task
+constexpr size_t deflate_chunk = 1 << 17; // filtered bytes deflated per task
+constexpr u32 block_tokens = 1 << 15;   // symbols per deflate block
+
+constexpr u32 window_size = 1 << 15;
+constexpr u32 hash_bits = 15;
+constexpr u32 max_chain = 32;
+constexpr u32 min_match = 3;
+constexpr u32 max_match = 258;
+
+constexpr u32 litlen_count = 286;
+constexpr u32 dist_count = 30;
+constexpr u32 codelen_count = 19;
+constexpr u32 end_of_block = 256;
+
+constexpr u32 length_base[29] = {3,  4,  5,  6,   7,   8,   9,   10,  11, 13,
+                                 15, 17, 19, 23,  27,  31,  35,  43,  51, 59,
+                                 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr u32 length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr u32 dist_base[30] = {1,    2,    3,    4,    5,    7,     9,
+                               13,   17,   25,   33,   49,   65,    97,
+                               129,  193,  257,  385,  513,  769,   1025,
+                               1537, 2049, 3073, 4097, 6145, 8193,  12289,
+                               16385, 24577};
+constexpr u32 dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+constexpr u32 codelen_extra[codelen_count] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 0, 0, 0, 0, 0, 2, 3, 7};
+constexpr u8 codelen_order[codelen_count] = {16, 17, 18, 0, 8,  7, 9,  6, 10, 5,
+                                             11, 4,  12, 3, 13, 2, 14, 1, 15};
+
+/// Huffman code with its bits reversed, deflate writes codes MSB first into
+/// an LSB first stream.
+struct Code {
+  u32 bits;
+  u32 length;
+};
+
+struct Tables {
+  u8 length_code[max_match + 1];
+  u8 dist_code[512];
+  u8 fixed_litlen_len[288];
+  u8 fixed_dist_len[dist_count];
+  Code fixed_litlen[288];
+  Code fixed_dist[dist_count];
+  u32 crc[256];
+};
+
+static void assign_codes(const u8 *lengths, u32 count, Code *codes) {
+  u32 length_count[16] = {};
+  for (u32 s = 0; s < count; ++s)
+    ++length_count[lengths[s]];
+  length_count[0] = 0;
+
+  u32 next_code[16] = {};
+  for (u32 bits = 1, code = 0; bits < 16; ++bits) {
+    code = (code + length_count[bits - 1]) << 1;
+    next_code[bits] = code;
+  }
+
+  for (u32 s = 0; s < count; ++s) {
+    const u32 length = lengths[s];
+    u32 code = length ? next_code[length]++ : 0;
+    u32 reversed = 0;
+
+    for (u32 b = 0; b < length; ++b, code >>= 1)
+      reversed = (reversed << 1) | (code & 1);
+
+    codes[s] = {reversed, length};
+  }
+}
+
+static const Tables &tables() {
+  static const Tables tables = [] {
+    Tables t;
+
+    for (u32 code = 0; code < 29; ++code) {
+      for (u32 len = length_base[code];
+           len < length_base[code] + (1u << length_extra[code]) &&
+           len <= max_match;
+           ++len)
+        t.length_code[len] = code;
+    }
+    // NOTE: 258 has its own code though 227 + 31 reaches it too
+    t.length_code[max_match] = 28;
+
+    for (u32 code = 0; code < dist_count; ++code) {
+      for (u32 dist = dist_base[code];
+           dist < dist_base[code] + (1u << dist_extra[code]); ++dist) {
+        if (dist <= 256)
+          t.dist_code[dist - 1] = code;
+        else
+          t.dist_code[256 + ((dist - 1) >> 7)] = code;
+      }
+    }
+
+    for (u32 s = 0; s < 288; ++s)
+      t.fixed_litlen_len[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+    std::fill(t.fixed_dist_len, t.fixed_dist_len + dist_count, 5);
+    assign_codes(t.fixed_litlen_len, 288, t.fixed_litlen);
+    assign_codes(t.fixed_dist_len, dist_count, t.fixed_dist);
+
+    for (u32 n = 0; n < 256; ++n) {
+      u32 c = n;
+      for (u32 k = 0; k < 8; ++k)
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      t.crc[n] = c;
+    }
+
+    return t;
+  }();
+
+  return tables;
+}
+
+static u32 dist_code(u32 dist) {
+  return dist <= 256 ? tables().dist_code[dist - 1]
+                     : tables().dist_code[256 + ((dist - 1) >> 7)];
+}
+
+static u32 crc32(u32 crc, const u8 *data, size_t size) {
+  const u32 *table = tables().crc;
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+constexpr u32 adler_mod = 65521;
+
+static u32 adler32(const u8 *data, size_t size) {
+  u32 a = 1, b = 0;
+
+  // NOTE: 5552 bytes is the most that can't overflow b before the modulo
+  while (size > 0) {
+    const size_t n = std::min<size_t>(size, 5552);
+    for (size_t i = 0; i < n; ++i) {
+      a += data[i];
+      b += a;
+    }
+
+    a %= adler_mod;
+    b %= adler_mod;
+    data += n;
+    size -= n;
+  }
+
+  return a | (b << 16);
+}
+
+/// Adler-32 of A followed by B, from those of A and B.
+static u32 adler32_combine(u32 adler1, u32 adler2, size_t size2) {
+  const u32 rem = size2 % adler_mod;
+  u32 sum1 = adler1 & 0xffff;
+  u32 sum2 = static_cast<u32>(static_cast<umax>(rem) * sum1 % adler_mod);
+
+  sum1 += (adler2 & 0xffff) + adler_mod - 1;
+  sum2 += (adler1 >> 16) + (adler2 >> 16) + adler_mod - rem;
+
+  sum1 %= adler_mod;
+  sum2 %= adler_mod;
+  return sum1 | (sum2 << 16);
+}
+
+/// Code lengths of at most limit bits for the symbol frequencies, zero for
+/// unused symbols.
+static void build_lengths(const u32 *freq, u32 count, u32 limit, u8 *lengths) {
+  std::vector<u32> symbols;
+  std::vector<umax> weights;
+
+  for (u32 s = 0; s < count; ++s) {
+    lengths[s] = 0;
+    if (freq[s] > 0) {
+      symbols.push_back(s);
+      weights.push_back(freq[s]);
+    }
+  }
+
+  // NOTE: inflate rejects a code of one symbol unless it is one bit long and
+  // code length codes must be complete, so lone symbols get a partner
+  if (symbols.size() == 1) {
+    lengths[symbols[0]] = 1;
+    lengths[symbols[0] == 0 ? 1 : 0] = 1;
+    return;
+  }
+
+  const u32 n = symbols.size();
+  if (n == 0)
+    return;
+
+  // NOTE: halving weights until the tree fits keeps it close to optimal,
+  // deep trees are rare
+  for (;;) {
+    using Item = std::pair<umax, u32>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> heap;
+    std::vector<u32> parent(2 * n - 1);
+
+    for (u32 i = 0; i < n; ++i)
+      heap.push({weights[i], i});
+
+    u32 next = n;
+    while (heap.size() > 1) {
+      Item a = heap.top();
+      heap.pop();
+      Item b = heap.top();
+      heap.pop();
+
+      parent[a.second] = parent[b.second] = next;
+      heap.push({a.first + b.first, next++});
+    }
+
+    // NOTE: parents are made after their children, the root is last
+    std::vector<u32> depth(next, 0);
+    for (u32 node = next - 1; node-- > 0;)
+      depth[node] = depth[parent[node]] + 1;
+
+    if (*std::max_element(depth.begin(), depth.begin() + n) <= limit) {
+      for (u32 i = 0; i < n; ++i)
+        lengths[symbols[i]] = depth[i];
+      return;
+    }
+
+    for (umax &weight : weights)
+      weight = (weight + 1) / 2;
+  }
+}
+
+struct BitWriter {
+  std::string &out;
+  umax bits = 0;
+  u32 count = 0;
+
+  void put(u32 value, u32 length) {
+    bits |= static_cast<umax>(value) << count;
+    count += length;
+
+    for (; count >= 8; count -= 8, bits >>= 8)
+      out.push_back(static_cast<char>(bits));
+  }
+
+  void put(const Code &code) { put(code.bits, code.length); }
+
+  void align() {
+    if (count > 0)
+      put(0, 8 - count);
+  }
+};
+
+/// Literal if dist is 0, else a match of length litlen.
+struct Token {
+  u32 litlen;
+  u32 dist;
+};
+
+static void put_tokens(BitWriter &bw, const std::vector<Token> &tokens,
+                       const Code *litlen, const Code *dist) {
+  const Tables &t = tables();
+
+  for (const Token &token : tokens) {
+    if (token.dist == 0) {
+      bw.put(litlen[token.litlen]);
+      continue;
+    }
+
+    const u32 lc = t.length_code[token.litlen];
+    bw.put(litlen[257 + lc]);
+    bw.put(token.litlen - length_base[lc], length_extra[lc]);
+
+    const u32 dc = dist_code(token.dist);
+    bw.put(dist[dc]);
+    bw.put(token.dist - dist_base[dc], dist_extra[dc]);
+  }
+
+  bw.put(litlen[end_of_block]);
+}
+
+static void put_stored(BitWriter &bw, const u8 *raw, size_t size) {
+  do {
+    const u32 n = std::min<size_t>(size, 0xffff);
+
+    bw.put(0, 1);
+    bw.put(0, 2);
+    bw.align();
+    bw.put(n, 16);
+    bw.put(~n & 0xffff, 16);
+    bw.out.append(reinterpret_cast<const char *>(raw), n);
+
+    raw += n;
+    size -= n;
+  } while (size > 0);
+}
+
+/// Writes tokens as a non final block, whichever of dynamic, fixed or
+/// stored is smallest. raw holds the bytes the tokens stand for.
+static void put_block(BitWriter &bw, const std::vector<Token> &tokens,
+                      const u8 *raw, size_t raw_size) {
+  const Tables &t = tables();
+  u32 litlen_freq[litlen_count] = {};
+  u32 dist_freq[dist_count] = {};
+  umax extra_bits = 0;
+
+  litlen_freq[end_of_block] = 1;
+  for (const Token &token : tokens) {
+    if (token.dist == 0) {
+      ++litlen_freq[token.litlen];
+      continue;
+    }
+
+    const u32 lc = t.length_code[token.litlen];
+    const u32 dc = dist_code(token.dist);
+    ++litlen_freq[257 + lc];
+    ++dist_freq[dc];
+    extra_bits += length_extra[lc] + dist_extra[dc];
+  }
+
+  u8 litlen_len[litlen_count];
+  u8 dist_len[dist_count];
+  build_lengths(litlen_freq, litlen_count, 15, litlen_len);
+  build_lengths(dist_freq, dist_count, 15, dist_len);
+
+  u32 hlit = litlen_count;
+  while (hlit > 257 && litlen_len[hlit - 1] == 0)
+    --hlit;
+  u32 hdist = dist_count;
+  while (hdist > 1 && dist_len[hdist - 1] == 0)
+    --hdist;
+
+  // NOTE: code lengths of both trees run length coded as one sequence
+  std::vector<u8> lens(litlen_len, litlen_len + hlit);
+  lens.insert(lens.end(), dist_len, dist_len + hdist);
+
+  std::vector<std::pair<u8, u8>> rle; // code length symbol, extra value
+  for (size_t i = 0; i < lens.size();) {
+    const u8 len = lens[i];
+    size_t run = 1;
+    while (i + run < lens.size() && lens[i + run] == len)
+      ++run;
+    i += run;
+
+    if (len != 0) {
+      rle.push_back({len, 0});
+      --run;
+      for (; run >= 3; run -= std::min<size_t>(run, 6))
+        rle.push_back({16, static_cast<u8>(std::min<size_t>(run, 6) - 3)});
+    } else {
+      for (; run >= 11; run -= std::min<size_t>(run, 138))
+        rle.push_back({18, static_cast<u8>(std::min<size_t>(run, 138) - 11)});
+      if (run >= 3) {
+        rle.push_back({17, static_cast<u8>(run - 3)});
+        run = 0;
+      }
+    }
+
+    for (; run > 0; --run)
+      rle.push_back({len, 0});
+  }
+
+  u32 codelen_freq[codelen_count] = {};
+  for (const auto &sym : rle)
+    ++codelen_freq[sym.first];
+
+  u8 codelen_len[codelen_count];
+  build_lengths(codelen_freq, codelen_count, 7, codelen_len);
+
+  u32 hclen = codelen_count;
+  while (hclen > 4 && codelen_len[codelen_order[hclen - 1]] == 0)
+    --hclen;
+
+  umax dynamic_bits = 5 + 5 + 4 + 3 * hclen + extra_bits;
+  umax fixed_bits = extra_bits;
+  for (const auto &sym : rle)
+    dynamic_bits += codelen_len[sym.first] + codelen_extra[sym.first];
+  for (u32 s = 0; s < litlen_count; ++s) {
+    dynamic_bits += static_cast<umax>(litlen_freq[s]) * litlen_len[s];
+    fixed_bits += static_cast<umax>(litlen_freq[s]) * t.fixed_litlen_len[s];
+  }
+  for (u32 s = 0; s < dist_count; ++s) {
+    dynamic_bits += static_cast<umax>(dist_freq[s]) * dist_len[s];
+    fixed_bits += static_cast<umax>(dist_freq[s]) * t.fixed_dist_len[s];
+  }
+
+  const umax stored_bits = (raw_size + 5 * (raw_size / 0xffff + 1)) * 8;
+
+  if (stored_bits < dynamic_bits && stored_bits < fixed_bits) {
+    put_stored(bw, raw, raw_size);
+  } else if (fixed_bits <= dynamic_bits) {
+    bw.put(0, 1);
+    bw.put(1, 2);
+    put_tokens(bw, tokens, t.fixed_litlen, t.fixed_dist);
+  } else {
+    Code litlen[litlen_count], dist[dist_count], codelen[codelen_count];
+    assign_codes(litlen_len, litlen_count, litlen);
+    assign_codes(dist_len, dist_count, dist);
+    assign_codes(codelen_len, codelen_count, codelen);
+
+    bw.put(0, 1);
+    bw.put(2, 2);
+    bw.put(hlit - 257, 5);
+    bw.put(hdist - 1, 5);
+    bw.put(hclen - 4, 4);
+    for (u32 i = 0; i < hclen; ++i)
+      bw.put(codelen_len[codelen_order[i]], 3);
+    for (const auto &sym : rle) {
+      bw.put(codelen[sym.first]);
+      bw.put(sym.second, codelen_extra[sym.first]);
+    }
+
+    put_tokens(bw, tokens, litlen, dist);
+  }
+}
+
+static u32 hash_of(const u8 *p) {
+  const u32 v = p[0] | (p[1] << 8) | (p[2] << 16);
+  return (v * 2654435761u) >> (32 - hash_bits);
+}
+
+/// Deflates data[beg, end) into out as blocks that continue the stream,
+/// matches may reach back before beg since that data precedes it in the
+/// stream. Ends byte aligned, with the final block if is_last.
+static void deflate(std::string &out, const u8 *data, size_t beg, size_t end,
+                    bool is_last) {
+  const size_t base = beg > window_size ? beg - window_size : 0;
+  std::vector<i32> head(1 << hash_bits, -1);
+  std::vector<i32> prev(end - base, -1);
+
+  auto insert = [&](size_t pos) {
+    if (pos + min_match > end)
+      return;
+
+    i32 &first = head[hash_of(data + pos)];
+    prev[pos - base] = first;
+    first = pos - base;
+  };
+
+  for (size_t pos = base; pos < beg; ++pos)
+    insert(pos);
+
+  BitWriter bw{out};
+  std::vector<Token> tokens;
+  size_t block_beg = beg;
+  tokens.reserve(block_tokens);
+
+  for (size_t pos = beg; pos < end;) {
+    const u32 limit = std::min<size_t>(max_match, end - pos);
+    u32 best_len = 0, best_dist = 0;
+
+    if (limit >= min_match) {
+      i32 cand = head[hash_of(data + pos)];
+
+      for (u32 chain = max_chain; cand >= 0 && chain > 0; --chain) {
+        const size_t at = base + cand;
+        if (pos - at > window_size)
+          break;
+
+        if (data[at + best_len] == data[pos + best_len]) {
+          u32 len = 0;
+          while (len < limit && data[at + len] == data[pos + len])
+            ++len;
+
+          if (len > best_len) {
+            best_len = len;
+            best_dist = pos - at;
+            if (len == limit)
+              break;
+          }
+        }
+
+        cand = prev[cand];
+      }
+    }
+
+    insert(pos);
+
+    if (best_len >= min_match) {
+      tokens.push_back({best_len, best_dist});
+      for (size_t p = pos + 1; p < pos + best_len; ++p)
+        insert(p);
+      pos += best_len;
+    } else {
+      tokens.push_back({data[pos], 0});
+      ++pos;
+    }
+
+    if (tokens.size() == block_tokens || pos == end) {
+      put_block(bw, tokens, data + block_beg, pos - block_beg);
+      tokens.clear();
+      block_beg = pos;
+    }
+  }
+
+  if (is_last) {
+    // NOTE: an empty fixed block ends the stream
+    bw.put(1, 1);
+    bw.put(1, 2);
+    bw.put(tables().fixed_litlen[end_of_block]);
+    bw.align();
+  } else {
+    // NOTE: an empty stored block aligns to a byte so the next chunk's
+    // blocks can follow directly
+    bw.put(0, 1);
+    bw.put(0, 2);
+    bw.align();
+    bw.put(0, 16);
+    bw.put(0xffff, 16);
+  }
+}
+
+static u8 paeth(u8 a, u8 b, u8 c) {
+  const i32 p = static_cast<i32>(a) + b - c;
+  const i32 pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+/// Filter type byte and filtered row, picks the filter with the smallest
+/// sum of absolute signed bytes.
+static void filter_row(u8 *out, const u8 *row, const u8 *up, u32 size) {
+  constexpr u32 bpp = 3;
+
+  auto predict = [&](u32 type, u32 i) -> u8 {
+    const u8 a = i >= bpp ? row[i - bpp] : 0;
+    const u8 b = up[i];
+    const u8 c = i >= bpp ? up[i - bpp] : 0;
+
+    switch (type) {
+    case 1:
+      return a;
+    case 2:
+      return b;
+    case 3:
+      return (a + b) / 2;
+    case 4:
+      return paeth(a, b, c);
+    }
+    return 0;
+  };
+
+  u32 best_type = 0;
+  umax best_cost = ~umax(0);
+
+  for (u32 type = 0; type < 5; ++type) {
+    umax cost = 0;
+    for (u32 i = 0; i < size && cost < best_cost; ++i)
+      cost += abs(static_cast<signed char>(row[i] - predict(type, i)));
+
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_type = type;
+    }
+  }
+
+  out[0] = best_type;
+  for (u32 i = 0; i < size; ++i)
+    out[1 + i] = row[i] - predict(best_type, i);
+}
+
+static void put_u32(std::string &out, u32 value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back(static_cast<char>(value >> shift));
+}
+
+static std::string chunk_of(const char *type, const std::string &data) {
+  std::string chunk;
+  chunk.reserve(data.size() + 12);
+
+  put_u32(chunk, data.size());
+  chunk.append(type, 4);
+  chunk += data;
+
+  const u8 *crc_beg = reinterpret_cast<const u8 *>(chunk.data()) + 4;
+  put_u32(chunk, crc32(0, crc_beg, data.size() + 4));
+  return chunk;
+}
+
+void encode(std::vector<std::string> &parts, const u8 *rgb, V2u resolution,
+            const std::string &comment) {
+  const u32 row_size = resolution.x * 3;
+  const size_t filtered_row = row_size + 1;
+  const size_t size = filtered_row * resolution.y;
+  std::vector<u8> filtered(size);
+
+  const u32 row_chunks = (resolution.y + rows_per_chunk - 1) / rows_per_chunk;
+  pool::parallel_for(row_chunks, [&](u32 chunk, u32) {
+    const std::vector<u8> zeros(row_size, 0);
+    const u32 row_beg = chunk * rows_per_chunk;
+    const u32 row_end = std::min(row_beg + rows_per_chunk, resolution.y);
+
+    for (u32 y = row_beg; y < row_end; ++y) {
+      const u8 *row = rgb + static_cast<size_t>(y) * row_size;
+      filter_row(&filtered[y * filtered_row], row,
+                 y > 0 ? row - row_size : zeros.data(), row_size);
+    }
+  });
+
+  // NOTE: every piece is its own IDAT chunk so CRCs are parallel too
+  const u32 piece_count = (size + deflate_chunk - 1) / deflate_chunk;
+  std::vector<std::string> pieces(piece_count);
+  std::vector<u32> adlers(piece_count);
+
+  pool::parallel_for(piece_count, [&](u32 piece, u32) {
+    const size_t beg = piece * deflate_chunk;
+    const size_t end = std::min(beg + deflate_chunk, size);
+
+    if (piece == 0)
+      pieces[piece] = "\x78\x9c"; // zlib header, deflate with 32K window
+    deflate(pieces[piece], filtered.data(), beg, end, piece == piece_count - 1);
+    adlers[piece] = adler32(filtered.data() + beg, end - beg);
+  });
+
+  u32 adler = adlers[0];
+  for (u32 piece = 1; piece < piece_count; ++piece) {
+    const size_t beg = piece * deflate_chunk;
+    adler = adler32_combine(adler, adlers[piece],
+                            std::min(beg + deflate_chunk, size) - beg);
+  }
+  put_u32(pieces.back(), adler);
+
+  std::string ihdr;
+  put_u32(ihdr, resolution.x);
+  put_u32(ihdr, resolution.y);
+  ihdr += std::string("\x08\x02\x00\x00\x00", 5); // 8 bit RGB, no interlace
+
+  parts.assign(piece_count + 2, {});
+  parts.front() = std::string("\x89PNG\r\n\x1a\n", 8) + chunk_of("IHDR", ihdr);
+  if (!comment.empty())
+    parts.front() += chunk_of("tEXt", std::string("Comment", 8) + comment);
+  parts.back() = chunk_of("IEND", {});
+
+  pool::parallel_for(piece_count, [&](u32 piece, u32) {
+    parts[1 + piece] = chunk_of("IDAT", pieces[piece]);
+    std::string().swap(pieces[piece]);
+  });
+}
+
+} // namespace png
@@ -0,0 +1,20 @@
+#pragma once
+
+/// PNG encoder with its own deflate. Scanlines are filtered and compressed
+/// in parallel on the pool, each compressed chunk ends byte aligned so they
+/// join into one zlib stream.
+
+#include "types.hpp"
+#include "vector.hpp"
+
+#include <string>
+#include <vector>
+
+namespace png {
+
+/// Encodes 8 bit RGB rows of resolution.x * 3 bytes, the file is the
+/// concatenation of parts. comment goes into a tEXt chunk if not empty.
+void encode(std::vector<std::string> &parts, const u8 *rgb, V2u resolution,
+            const std::string &comment = {});
+
+} // namespace png
@@ -0,0 +1,243 @@
+#include "pool.hpp"
+#include "tile.hpp"
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace pool {
+
+struct Job {
+  Group *group;
+  Task task;
+};
+
+struct Worker {
+  pthread_t pid;
+  std::deque<Job> jobs;
+};
+
+struct Pool {
+  std::mutex mutex;
+  std::condition_variable job_added;
+  std::condition_variable job_done;
+  std::unique_ptr<Worker[]> workers;
+  u32 worker_count = 0;
+  u32 next_worker = 0; // round robin target of run()
+  bool quit = false;
+};
+
+static Pool pool;
+static thread_local u32 this_worker = ~0u;
+
+/// Own jobs are taken from the front, others are stolen from the back.
+static bool take(u32 worker, Job &job) {
+  if (worker < pool.worker_count && !pool.workers[worker].jobs.empty()) {
+    job = std::move(pool.workers[worker].jobs.front());
+    pool.workers[worker].jobs.pop_front();
+    return true;
+  }
+
+  for (u32 i = 0; i < pool.worker_count; ++i) {
+    std::deque<Job> &jobs = pool.workers[(worker + i) % pool.worker_count].jobs;
+    if (!jobs.empty()) {
+      job = std::move(jobs.back());
+      jobs.pop_back();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void execute(Job &job, u32 worker, std::unique_lock<std::mutex> &lock) {
+  lock.unlock();
+  job.task(worker);
+  lock.lock();
+
+  if (--job.group->pending == 0)
+    pool.job_done.notify_all();
+}
+
+static void *work(void *arg) {
+  const u32 worker = static_cast<u32>(reinterpret_cast<uintptr_t>(arg));
+  this_worker = worker;
+
+  std::unique_lock<std::mutex> lock(pool.mutex);
+
+  while (true) {
+    Job job;
+
+    if (take(worker, job)) {
+      execute(job, worker, lock);
+    } else if (pool.quit) {
+      break;
+    } else {
+      pool.job_added.wait(lock);
+    }
+  }
+
+  return 0;
+}
+
+int init(u32 worker_count) {
+  if (pool.worker_count > 0) {
+    fprintf(stderr, "Thread pool is already running!\n");
+    return -1;
+  }
+
+  if (worker_count == 0) {
+    fprintf(stderr, "Thread pool needs at least 1 worker!\n");
+    return -1;
+  }
+
+  pool.quit = false;
+  pool.workers.reset(new Worker[worker_count]);
+  pool.worker_count = worker_count;
+
+  for (u32 i = 0; i < worker_count; ++i) {
+    if (pthread_create(&pool.workers[i].pid, NULL, work,
+                       reinterpret_cast<void *>(static_cast<uintptr_t>(i)))) {
+      fprintf(stderr, "Failed to create worker thread %u\n", i);
+      pool.worker_count = i;
+      shutdown();
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+void shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    pool.quit = true;
+  }
+  pool.job_added.notify_all();
+
+  for (u32 i = 0; i < pool.worker_count; ++i)
+    pthread_join(pool.workers[i].pid, NULL);
+
+  pool.workers.reset();
+  pool.worker_count = 0;
+}
+
+u32 worker_count() { return pool.worker_count; }
+
+int pin(u32 worker, const cpu_set_t &cpus) {
+  if (worker >= pool.worker_count ||
+      pthread_setaffinity_np(pool.workers[worker].pid, sizeof(cpus), &cpus)) {
+    fprintf(stderr, "Failed to pin worker thread %u\n", worker);
+    return -1;
+  }
+
+  return 0;
+}
+
+u32 current_worker() {
+  return this_worker < pool.worker_count ? this_worker : pool.worker_count;
+}
+
+void run(Group &group, Task task) {
+  {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    ++group.pending;
+
+    u32 target = this_worker;
+    if (target >= pool.worker_count) {
+      target = pool.next_worker;
+      pool.next_worker = (pool.next_worker + 1) % pool.worker_count;
+    }
+
+    pool.workers[target].jobs.push_back({&group, std::move(task)});
+  }
+  pool.job_added.notify_one();
+}
+
+void wait(Group &group) {
+  const u32 worker = current_worker();
+  std::unique_lock<std::mutex> lock(pool.mutex);
+
+  while (group.pending > 0) {
+    Job job;
+
+    if (worker < pool.worker_count && take(worker, job))
+      execute(job, worker, lock);
+    else
+      pool.job_done.wait(lock);
+  }
+}
+
+void parallel_for(u32 count,
+                  const std::function<void(u32 index, u32 worker)> &fn) {
+  tile::Scheduler sched;
+
+  tile::deal(sched, count, pool.worker_count);
+  parallel_for(sched, fn);
+}
+
+void parallel_for(tile::Scheduler &sched,
+                  const std::function<void(u32 index, u32 worker)> &fn) {
+  Group group;
+
+  // NOTE: one loop per worker, any of them ends up draining every queue
+  for (u32 slot = 0; slot < sched.queue_count; ++slot) {
+    run(group, [&](u32 worker) {
+      u32 index;
+      while (tile::next(sched, worker % sched.queue_count, index))
+        fn(index, worker);
+    });
+  }
+
+  wait(group);
+}
+
+
+u32 add(Graph &graph, Task task, std::initializer_list<u32> deps) {
+  const u32 id = graph.nodes.size();
+
+  graph.nodes.emplace_back();
+  graph.nodes.back().task = std::move(task);
+  graph.nodes.back().pending = deps.size();
+
+  for (u32 dep : deps)
+    graph.nodes[dep].dependents.push_back(id);
+
+  return id;
+}
+
+static void submit(Graph &graph, Group &group, u32 id) {
+  run(group, [&graph, &group, id](u32 worker) {
+    Graph::Node &node = graph.nodes[id];
+    node.task(worker);
+
+    for (u32 dependent : node.dependents) {
+      if (--graph.nodes[dependent].pending == 0)
+        submit(graph, group, dependent);
+    }
+  });
+}
+
+void run(Graph &graph) {
+  Group group;
+  std::vector<u32> roots;
+
+  // NOTE: roots are gathered first, once a node runs the pending counts of
+  // the others change under us
+  for (u32 id = 0; id < graph.nodes.size(); ++id) {
+    if (graph.nodes[id].pending == 0)
+      roots.push_back(id);
+  }
+
+  for (u32 id : roots)
+    submit(graph, group, id);
+
+  wait(group);
+}
+
+} // namespace pool
@@ -0,0 +1,71 @@
+#pragma once
+
+/// Persistent worker threads shared by every stage of the renderer. Created
+/// once with init(), jobs are plain tasks in groups or parallel_for loops.
+
+#include "tile.hpp"
+#include "types.hpp"
+
+#include <sched.h>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <vector>
+
+namespace pool {
+
+/// worker is the index of the executing pool thread, use it to pick
+/// per thread state.
+using Task = std::function<void(u32 worker)>;
+
+struct Group {
+  std::atomic<u32> pending{0};
+};
+
+int init(u32 worker_count);
+void shutdown();
+
+u32 worker_count();
+
+/// Restricts a worker to the given cpus.
+int pin(u32 worker, const cpu_set_t &cpus);
+
+/// Worker index of the calling thread, worker_count() if it isn't a worker.
+u32 current_worker();
+
+void run(Group &group, Task task);
+
+/// Blocks until every task of group is done. Workers run queued tasks
+/// meanwhile, so tasks holding per worker state must not wait.
+void wait(Group &group);
+
+/// Calls fn(index, worker) for index in [0, count), load balanced by work
+/// stealing, returns when all are done.
+void parallel_for(u32 count, const std::function<void(u32 index, u32 worker)> &fn);
+
+/// Same as above over indices already dealt to the worker queues of sched,
+/// a worker drains its own queue first.
+void parallel_for(tile::Scheduler &sched,
+                  const std::function<void(u32 index, u32 worker)> &fn);
+
+/// Tasks with dependencies, a node runs once all nodes it depends on are
+/// done.
+struct Graph {
+  struct Node {
+    Task task;
+    std::vector<u32> dependents;
+    std::atomic<u32> pending{0};
+  };
+
+  std::deque<Node> nodes;
+};
+
+/// deps must be added before, returns id of the new node.
+u32 add(Graph &graph, Task task, std::initializer_list<u32> deps = {});
+
+/// Runs every node of graph, blocks until all are done.
+void run(Graph &graph);
+
+} // namespace pool
@@ -0,0 +1,89 @@
+#include "progressive.hpp"
+#include "pool.hpp"
+
+#include <string.h>
+
+#include <atomic>
+
+namespace progressive {
+
+static bool is_past(const timespec &deadline) {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return now.tv_sec > deadline.tv_sec ||
+         (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+}
+
+int render(u8 *framebuffer, std::vector<ray::Input> &ray_in,
+           const std::vector<tile::Tile> &tiles, V2u resolution,
+           u32 tile_size, const timespec &deadline, Result &result) {
+  const u32 tiles_x = (resolution.x + tile_size - 1) / tile_size;
+
+  // NOTE: a flag per tile and pass, written by whoever traced that tile
+  std::vector<char> done(tiles.size() * tile::pass_count, 0);
+
+  auto is_traced = [&](V2u pixel) {
+    u32 tile_id = (pixel.y / tile_size) * tiles_x + pixel.x / tile_size;
+    return done[tile_id * tile::pass_count + tile::pass_of(pixel)] != 0;
+  };
+
+  for (u32 pass = 0; pass < tile::pass_count; ++pass) {
+    std::atomic<bool> late{false};
+
+    pool::parallel_for(tiles.size(), [&](u32 tile_id, u32 worker) {
+      if (pass > 0 && (late || is_past(deadline))) {
+        late = true;
+        return;
+      }
+
+      ray::trace(framebuffer, &ray_in[worker], tiles[tile_id], pass);
+      done[tile_id * tile::pass_count + pass] = 1;
+    });
+
+    if (late)
+      break;
+  }
+
+  std::vector<umax> row_traced(resolution.y);
+  const size_t pixel_size = pixel::size_of(ray_in.front().pixel_format);
+
+  pool::parallel_for(resolution.y, [&](u32 y, u32) {
+    u8 *row = framebuffer + static_cast<size_t>(y) * resolution.x * pixel_size;
+    umax traced = 0;
+
+    for (u32 x = 0; x < resolution.x; ++x) {
+      V2u pixel = v2u(x, y);
+
+      if (is_traced(pixel)) {
+        ++traced;
+        continue;
+      }
+
+      // NOTE: pass 0 always completes, so the loop finds an anchor
+      for (i32 pass = tile::pass_of(pixel) - 1; pass >= 0; --pass) {
+        const u32 stride = tile::pass_stride(pass);
+        V2u anchor = v2u(x / stride * stride, y / stride * stride);
+
+        if (is_traced(anchor)) {
+          const size_t at =
+              static_cast<size_t>(anchor.y) * resolution.x + anchor.x;
+          memcpy(row + x * pixel_size, framebuffer + at * pixel_size,
+                 pixel_size);
+          break;
+        }
+      }
+    }
+
+    row_traced[y] = traced;
+  });
+
+  result.traced = 0;
+  result.total = static_cast<umax>(resolution.x) * resolution.y;
+  for (umax traced : row_traced)
+    result.traced += traced;
+
+  return 0;
+}
+
+} // namespace progressive
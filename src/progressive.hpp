@@ -0,0 +1,26 @@
+#pragma once
+
+/// Deadline bound rendering. A coarse pass over the whole image always
+/// runs, finer interlaced passes follow while time is left and every pixel
+/// not traced exactly takes the color of its nearest traced coarser pixel.
+
+#include "ray.hpp"
+#include "tile.hpp"
+
+#include <time.h>
+#include <vector>
+
+namespace progressive {
+
+struct Result {
+  umax traced; // pixels traced exactly
+  umax total;
+};
+
+/// tiles must come from tile::split() with tile_size, pixels of framebuffer
+/// are in the format of ray_in.
+int render(u8 *framebuffer, std::vector<ray::Input> &ray_in,
+           const std::vector<tile::Tile> &tiles, V2u resolution,
+           u32 tile_size, const timespec &deadline, Result &result);
+
+} // namespace progressive
@@ -1,9 +1,13 @@
 #include "ray.hpp"
 #include "log.hpp"
+#include "pool.hpp"
 
 #include <assert.h>
 #include <cmath>
 #include <limits>
+#include <stdio.h>
+
+#include <algorithm>
 
 namespace ray {
 
@@ -12,12 +16,14 @@ struct HitData {
   Material *material;
   V3 normal;
   V3 wo;
+  f32 weight; // brightest channel of reflectance product before this hit
 };
 
 namespace constant {
 constexpr f32 shadow_epsilon = 1e-4;
 constexpr f32 intersect_epsilon = 1e-4;
 constexpr f32 max_float = std::numeric_limits<f32>::max();
+constexpr f32 max_color = 255;
 } // namespace constant
 
 constexpr f32 determinant(const V3 &col0, const V3 &col1, const V3 &col2) {
@@ -66,25 +72,42 @@ constexpr Color ambient(const AmbientLight &light, const Material *mat) {
   return light.color * mat->ambient;
 }
 
-constexpr Color specular(const HitData &hit, const V3 &wi) {
+inline Color specular(const HitData &hit, const V3 &wi) {
   V3 h = norm(hit.wo + wi);
   return hit.material->specular *
-         pow(max(0, dot(hit.normal, h)), hit.material->phong);
+         phong_pow(*hit.material, max(0, dot(hit.normal, h)));
 }
 
-inline int in_shadow(const Ray &shadow_ray, f32 light_dist,
-                     const Scene &scene) {
-  f32 t_max = constant::max_float;
+inline int occludes(const Ray &shadow_ray, f32 light_dist,
+                    const TriangleFace &face) {
+  f32 t_intersect = intersects_at(shadow_ray, face);
 
-  for (const Mesh &cur_mesh : scene.meshes) {
-    for (const TriangleFace &cur_face : cur_mesh.faces) {
-      f32 t_intersect = intersects_at(shadow_ray, cur_face);
+  if (t_intersect < constant::max_float) {
+    f32 obj_dist = length(shadow_ray.at(t_intersect) - shadow_ray.origin);
+    return obj_dist < light_dist;
+  }
+
+  return 0;
+}
 
-      if (t_intersect < t_max) {
-        f32 obj_dist = length(shadow_ray.at(t_intersect) - shadow_ray.origin);
+/// Tests the cached occluder of the light first, neighbouring hits are
+/// likely to be blocked by the same face.
+inline int in_shadow(const Ray &shadow_ray, f32 light_dist, const Scene &scene,
+                     const TriangleFace *&occluder, Stats &stats) {
+  if (occluder) {
+    ++stats.occluder_tests;
+    if (occludes(shadow_ray, light_dist, *occluder)) {
+      ++stats.occluder_hits;
+      return 1;
+    }
+  }
 
-        if (obj_dist < light_dist)
-          return 1;
+  for (const Mesh &cur_mesh : scene.meshes) {
+    for (const TriangleFace &cur_face : cur_mesh.faces) {
+      if (&cur_face != occluder &&
+          occludes(shadow_ray, light_dist, cur_face)) {
+        occluder = &cur_face;
+        return 1;
       }
     }
   }
@@ -92,112 +115,273 @@ inline int in_shadow(const Ray &shadow_ray, f32 light_dist,
   return 0;
 }
 
-constexpr Color hit_color(const HitData *hits, u32 hits_size,
-                          const Scene &scene) {
-  Color next_color = v3(0, 0, 0);
+inline Color hit_color(const HitData &hit, const Scene &scene,
+                       const light::Tree &light_tree, Stats &stats,
+                       const TriangleFace **occluders) {
+  Color color = v3(0, 0, 0);
 
-  for (i32 hi = hits_size - 1; hi >= 0; --hi) {
-    Color cur_color = v3(0, 0, 0);
-    const HitData &hit = hits[hi];
+  for (const AmbientLight &light : scene.ambient_lights) {
+    color += ambient(light, hit.material);
+  }
 
-    for(const AmbientLight &light : scene.ambient_lights) {
-      cur_color += ambient(light, hit.material);
-    }
+  const Material &mat = *hit.material;
+  const f32 scale =
+      hit.weight * (light::max3(mat.diffuse) + light::max3(mat.specular));
 
-    for(const PointLight &light : scene.point_lights) {
-      const V3 wi = light.pos - hit.pos;
-      const f32 light_dist = length(wi);
-      const V3 norm_wi = norm(wi);
+  stats.light_queries += scene.point_lights.size();
+  stats.lights_culled += light::for_each_visible(
+      light_tree, hit.pos, scale, [&](u32 light_index) {
+    const PointLight &light = scene.point_lights[light_index];
+    const V3 wi = light.pos - hit.pos;
+    const f32 light_dist = length(wi);
+    const V3 norm_wi = norm(wi);
 
-      const Ray shadow_ray = {
-          .origin = hit.pos + norm_wi * constant::shadow_epsilon,
-          .direction = norm_wi,
-      };
+    const Ray shadow_ray = {
+        .origin = hit.pos + norm_wi * constant::shadow_epsilon,
+        .direction = norm_wi,
+    };
 
-      if (in_shadow(shadow_ray, light_dist, scene))
-        continue;
+    if (in_shadow(shadow_ray, light_dist, scene, occluders[light_index],
+                  stats))
+      return;
 
-      const V3 irradiance =
-          light.intensity * (1.0f / (light_dist * light_dist));
+    const V3 irradiance = light.intensity * (1.0f / (light_dist * light_dist));
 
-      cur_color +=
-          (diffuse(hit, norm_wi) + specular(hit, norm_wi)) * irradiance;
-    }
+    color += (diffuse(hit, norm_wi) + specular(hit, norm_wi)) * irradiance;
+  });
+
+  return color;
+}
 
-    next_color = cur_color + next_color * hit.material->reflectance;
+/// Further bounces can't show in the output once every channel is either
+/// clamped already, or can't change by enough to move an output step.
+// NOTE: 0 throughput times an unbounded remaining light is NaN, which
+// fails the compare as it should
+static bool is_invisible(const V3 &change, const Color &color,
+                         const Input &in) {
+  for (int i = 0; i < 3; ++i) {
+    if ((!in.is_clamped || color.e[i] < constant::max_color) &&
+        change.e[i] >= in.invisible_change)
+      return false;
   }
 
-  return next_color;
+  return true;
 }
 
-void *threaded_trace(void *arg) {
-  ThreadInput *tin = static_cast<ThreadInput *>(arg);
-  trace(tin->colors, tin->in);
+static Color trace_pixel(V2u pixel, const Plane &near_plane, Input *in) {
+  const Scene &scene = *in->scene;
+  const Camera &cam = scene.cam;
 
-  return 0;
+  Color color = scene.bg_color;
+  V3 throughput = v3(1, 1, 1);
+  Ray ray = ray_between(cam.pos, pixel_on_plane(pixel, near_plane));
+
+  for (u32 depth = 0; depth <= scene.max_ray_trace_depth; ++depth) {
+    f32 t_min = constant::max_float;
+    const Mesh *hit = nullptr;
+    V3 hit_normal;
+
+    for (const Mesh &cur_mesh : scene.meshes) {
+      for (const TriangleFace &cur_face : cur_mesh.faces) {
+        f32 t_intersect = intersects_at(ray, cur_face);
+
+        if (t_intersect < t_min) {
+          t_min = t_intersect;
+          hit = &cur_mesh;
+          hit_normal = cur_face.normal();
+        }
+      }
+    }
+
+    if (!hit)
+      break;
+
+    if (depth == 0)
+      color = v3(0, 0, 0);
+
+    HitData hit_data;
+    hit_data.pos = ray.at(t_min);
+    hit_data.material = hit->material;
+    hit_data.normal = norm(hit_normal);
+    hit_data.wo = norm(-ray.direction);
+    hit_data.weight = light::max3(throughput);
+
+    color += throughput * hit_color(hit_data, scene, *in->light_tree,
+                                    in->stats, in->occluders.data());
+
+    const V3 &reflectance = hit_data.material->reflectance;
+    if (length(reflectance) <= constant::shadow_epsilon)
+      break;
+
+    throughput = throughput * reflectance;
+
+    // NOTE: HDR output has no clamp and no output step, so it always
+    // bounces to full depth
+    const u32 remaining = scene.max_ray_trace_depth - depth;
+    if (!in->is_hdr && remaining > 0 &&
+        is_invisible(throughput * in->bound->remaining[remaining], color,
+                     *in)) {
+      in->stats.bounces_saved += remaining;
+      break;
+    }
+
+    ray.direction =
+        2 * dot(hit_data.wo, hit_data.normal) * hit_data.normal - hit_data.wo;
+    ray.origin = hit_data.pos + ray.direction * constant::intersect_epsilon;
+  }
+
+  // NOTE: clamping and quantizing is left to tonemap::pack
+  if (in->is_hdr)
+    return color * (1 / constant::max_color);
+
+  return color;
 }
 
-int trace(std::vector<Color> *colors, Input *in) {
+int trace(void *framebuffer, Input *in, const tile::Tile &tile, u32 pass,
+          V2u origin, u32 row_stride) {
   const Scene &scene = *in->scene;
   const Camera &cam = scene.cam;
-  const V2u &resolution = cam.resolution;
   const Plane near_plane = near_plane_of_cam(cam);
 
-  Color bg_color = clamp_max(scene.bg_color, 255);
-  
-  V2u pixel = v2u(0, in->y_range.beg);
+  if (in->occluders.size() != scene.point_lights.size())
+    in->occluders.assign(scene.point_lights.size(), nullptr);
 
-  for (; pixel.y < in->y_range.end; ++pixel.y) {
-    for (pixel.x = 0; pixel.x < resolution.x; ++pixel.x) {
+  // NOTE: a pass only visits its own grid, round tile start up onto it
+  const u32 stride = pass < tile::pass_count ? tile::pass_stride(pass) : 1;
+  const u32 beg_x = (tile.beg.x + stride - 1) / stride * stride;
+  V2u pixel = v2u(beg_x, (tile.beg.y + stride - 1) / stride * stride);
 
-      HitData hits[scene.max_ray_trace_depth + 1];
-      u32 hits_size = 0;
-      Ray ray = ray_between(cam.pos, pixel_on_plane(pixel, near_plane));
+  if (row_stride == 0)
+    row_stride = cam.resolution.x;
 
-      for (u32 depth = 0; depth <= scene.max_ray_trace_depth; ++depth) {
-        f32 t_min = constant::max_float;
-        const Mesh *hit = nullptr;
-        V3 hit_normal;
+  const pixel::Format format = in->pixel_format;
+  const size_t pixel_size = pixel::size_of(format);
 
-	for(const Mesh &cur_mesh : scene.meshes) {
-	  for(const TriangleFace &cur_face : cur_mesh.faces) {
-            f32 t_intersect = intersects_at(ray, cur_face);
+  for (; pixel.y < tile.end.y; pixel.y += stride) {
+    u8 *row = static_cast<u8 *>(framebuffer) +
+              static_cast<size_t>(pixel.y - origin.y) * row_stride * pixel_size;
 
-            if (t_intersect < t_min) {
-              t_min = t_intersect;
-              hit = &cur_mesh;
-              hit_normal = cur_face.normal();
-            }
-          }
-        }
+    for (pixel.x = beg_x; pixel.x < tile.end.x; pixel.x += stride) {
+      if (pass < tile::pass_count && tile::pass_of(pixel) != pass)
+        continue;
 
-        if (!hit)
-          break;
+      pixel::store(format, row + (pixel.x - origin.x) * pixel_size,
+                   trace_pixel(pixel, near_plane, in), in->tonemap);
+    }
+  }
 
-        hits[depth].pos = ray.at(t_min);
-        hits[depth].material = hit->material;
-        hits[depth].normal = norm(hit_normal);
-        hits[depth].wo = norm(-ray.direction);
-        ++hits_size;
+  return 0;
+}
 
-        if (length(hits[depth].material->reflectance) <= constant::shadow_epsilon)
-          break;
+/// Squared distance from p to the closest point of the triangle.
+static f32 dist_sqr(const TriangleFace &tri, Point3 p) {
+  const V3 ab = tri.b - tri.a;
+  const V3 ac = tri.c - tri.a;
+  const V3 ap = p - tri.a;
+  const f32 d1 = dot(ab, ap);
+  const f32 d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0)
+    return length_sqr(ap);
+
+  const V3 bp = p - tri.b;
+  const f32 d3 = dot(ab, bp);
+  const f32 d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3)
+    return length_sqr(bp);
+
+  const f32 vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return length_sqr(ap - ab * (d1 / (d1 - d3)));
+
+  const V3 cp = p - tri.c;
+  const f32 d5 = dot(ab, cp);
+  const f32 d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6)
+    return length_sqr(cp);
+
+  const f32 vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return length_sqr(ap - ac * (d2 / (d2 - d6)));
+
+  const f32 va = d3 * d6 - d5 * d4;
+  if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0)
+    return length_sqr(bp - (tri.c - tri.b) *
+                               ((d4 - d3) / ((d4 - d3) + (d5 - d6))));
+
+  // NOTE: degenerate triangles end up here too, they are never hit but
+  // their corners still bound the distance from below
+  const f32 denom = 1 / (va + vb + vc);
+  if (!std::isfinite(denom))
+    return std::min(length_sqr(ap), std::min(length_sqr(bp), length_sqr(cp)));
+
+  return length_sqr(ap - ab * (vb * denom) - ac * (vc * denom));
+}
 
-        ray.direction =
-            2 * dot(hits[depth].wo, hits[depth].normal) * hits[depth].normal -
-            hits[depth].wo;
-        ray.origin =
-            hits[depth].pos + ray.direction * constant::intersect_epsilon;
-      }
+int bound(Bound &bound, const Scene &scene) {
+  f32 ambient = 0;
+  for (const AmbientLight &light : scene.ambient_lights)
+    ambient += light::max3(light.color);
+
+  f32 max_ambient = 0;
+  f32 max_direct = 0;
+  f32 max_reflectance = 0;
+  for (const Material &mat : scene.materials) {
+    max_ambient = std::max(max_ambient, light::max3(mat.ambient));
+    max_direct = std::max(max_direct, light::max3(mat.diffuse) +
+                                          light::max3(mat.specular));
+    max_reflectance =
+        std::max(max_reflectance, light::max3(mat.reflectance));
+  }
 
-      if (hits_size > 0) {
-        colors->push_back(clamp_max(hit_color(hits, hits_size, scene), 255));
-      } else {
-        colors->push_back(bg_color);
-      }
+  // NOTE: cosines and phong terms are at most 1, so a light adds at most
+  // its intensity over its squared distance to the closest hit
+  const std::vector<PointLight> &lights = scene.point_lights;
+  std::vector<f32> closest(lights.size(), constant::max_float);
+
+  pool::parallel_for(lights.size(), [&](u32 i, u32) {
+    for (const Mesh &mesh : scene.meshes) {
+      for (const TriangleFace &face : mesh.faces)
+        closest[i] = std::min(closest[i], dist_sqr(face, lights[i].pos));
     }
+  });
+
+  double irradiance = 0;
+  for (size_t i = 0; i < lights.size(); ++i) {
+    // NOTE: hit positions are off the surface by rounding, so the distance
+    // is taken a bit shorter
+    const double dist = sqrt(closest[i]) - constant::intersect_epsilon;
+    irradiance += dist > 0 ? light::max3(lights[i].intensity) / (dist * dist)
+                           : HUGE_VAL;
   }
 
+  const f32 hit = ambient * max_ambient + max_direct * irradiance;
+
+  bound.remaining.assign(scene.max_ray_trace_depth + 1, 0);
+  for (u32 n = 1; n <= scene.max_ray_trace_depth; ++n)
+    bound.remaining[n] = hit + max_reflectance * bound.remaining[n - 1];
+
   return 0;
 }
+
+void add(Stats &to, const Stats &from) {
+  to.light_queries += from.light_queries;
+  to.lights_culled += from.lights_culled;
+  to.occluder_tests += from.occluder_tests;
+  to.occluder_hits += from.occluder_hits;
+  to.bounces_saved += from.bounces_saved;
+}
+
+void print(const Stats &stats) {
+  fprintf(stderr, "Lights culled: %ju of %ju (%.2f%%)\n", stats.lights_culled,
+          stats.light_queries,
+          stats.light_queries
+              ? 100.0 * stats.lights_culled / stats.light_queries
+              : 0.0);
+  fprintf(stderr, "Occluder cache hits: %ju of %ju (%.2f%%)\n",
+          stats.occluder_hits, stats.occluder_tests,
+          stats.occluder_tests
+              ? 100.0 * stats.occluder_hits / stats.occluder_tests
+              : 0.0);
+  fprintf(stderr, "Bounces saved: %ju\n", stats.bounces_saved);
+}
 } // namespace ray
@@ -1,6 +1,9 @@
 #pragma once
 
+#include "light.hpp"
+#include "pixel.hpp"
 #include "scene.hpp"
+#include "tile.hpp"
 #include "vector.hpp"
 
 #include <vector>
@@ -52,17 +55,60 @@ constexpr Ray ray_between(Point3 beg, Point3 end) {
 
 namespace ray {
 
+/// Per thread counters, summed and printed after the render.
+struct Stats {
+  umax light_queries;
+  umax lights_culled;
+  umax occluder_tests;
+  umax occluder_hits;
+  umax bounces_saved;
+};
+
+/// Bounds the light further bounces can still add to a pixel.
+struct Bound {
+  /// remaining[n] bounds every channel of the color n more bounces add at
+  /// unit throughput, on the 0-255 scale.
+  std::vector<f32> remaining;
+};
+
+/// Bounds the color of any hit by the ambient lights and every point light
+/// at its closest distance to the geometry, times the brightest materials.
+int bound(Bound &bound, const Scene &scene);
+
+/// State of a single tracing thread.
 struct Input {
   Scene *scene;
-  V2u y_range;
-};
+  const light::Tree *light_tree;
+  const Bound *bound;
+  Stats stats;
+
+  /// Colors are scaled so 1 is full output white instead of 255.
+  bool is_hdr = false;
+
+  /// Output clamps channels at full white, more light there can't show.
+  bool is_clamped = true;
 
-struct ThreadInput {
-  std::vector<Color> *colors;
-  Input *in;
+  /// Largest change of a channel, in 0-255 steps before tonemapping, that
+  /// can't move its output step.
+  f32 invisible_change = 0.5f;
+  /// How traced pixels are stored, tonemap maps them for rgb8.
+  pixel::Format pixel_format = pixel::Format::rgb32f;
+  tonemap::Operator tonemap = tonemap::Operator::linear;
+
+  /// Last face that blocked each point light, owned by the tracing thread.
+  std::vector<const TriangleFace *> occluders;
 };
 
-void *threaded_trace(void *arg);
-  
-int trace(std::vector<Color> *colors, Input *in);
+/// Writes colors of the tile into its place in the row major framebuffer of
+/// resolution.x * resolution.y pixels of in->pixel_format, tiles may be
+/// traced concurrently. Given an
+/// interlace pass, only the pixels that pass adds are traced. framebuffer may
+/// also hold only the part of the image from origin on, with rows row_stride
+/// pixels apart (resolution.x if 0).
+int trace(void *framebuffer, Input *in, const tile::Tile &tile,
+          u32 pass = tile::pass_count, V2u origin = v2u(0, 0),
+          u32 row_stride = 0);
+
+void add(Stats &to, const Stats &from);
+void print(const Stats &stats);
 } // namespace ray
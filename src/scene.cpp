@@ -1,7 +1,11 @@
 #include "scene.hpp"
+#include "pool.hpp"
 
 #include <string.h>
 #include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
 
 int material_by_id(Material *&material, std::vector<Material> &materials,
                    const char *name) {
@@ -19,3 +23,105 @@ int material_by_id(Material *&material, std::vector<Material> &materials,
 
   return -1;
 }
+
+void prepare_material(Material &material) {
+  const f32 phong = material.phong;
+
+  material.phong_table.clear();
+
+  if (phong >= 0 && phong <= phong::max_integer && phong == floorf(phong)) {
+    material.phong_kind = PhongKind::integer;
+    material.phong_int = static_cast<u32>(phong);
+    return;
+  }
+
+  material.phong_kind = PhongKind::reference;
+
+  if (!(phong > 0))
+    return;
+
+  std::vector<f32> &table = material.phong_table;
+  table.resize(phong::table_size + 1);
+
+  for (u32 i = 0; i <= phong::table_size; ++i)
+    table[i] = pow(static_cast<f32>(i) / phong::table_size, phong);
+
+  // NOTE: lerp error of x^phong peaks between samples, so checking every
+  // midpoint against pow() bounds the error of the whole table
+  for (u32 i = 0; i < phong::table_size; ++i) {
+    f32 x = (i + 0.5f) / phong::table_size;
+    f32 err = fabsf(pow_table(table.data(), x) - powf(x, phong));
+
+    if (err > phong::max_table_error) {
+      table.clear();
+      return;
+    }
+  }
+
+  material.phong_kind = PhongKind::table;
+}
+
+void prepare(Scene &scene) {
+  pool::parallel_for(scene.materials.size(), [&](u32 i, u32) {
+    prepare_material(scene.materials[i]);
+  });
+}
+
+void clone(Scene &to, const Scene &from) {
+  to.max_ray_trace_depth = from.max_ray_trace_depth;
+  to.bg_color = from.bg_color;
+  to.cam = from.cam;
+  to.ambient_lights = from.ambient_lights;
+  to.point_lights = from.point_lights;
+  to.materials = from.materials;
+
+  to.vertex_storage.assign(from.vertices.begin(), from.vertices.end());
+  to.vertices = span_of(to.vertex_storage);
+
+  to.meshes.resize(from.meshes.size());
+  for (size_t i = 0; i < from.meshes.size(); ++i) {
+    const Mesh &from_mesh = from.meshes[i];
+    Mesh &mesh = to.meshes[i];
+
+    mesh.triangle_ids.clear();
+    mesh.face_storage.assign(from_mesh.faces.begin(), from_mesh.faces.end());
+    mesh.faces = span_of(mesh.face_storage);
+    mesh.material = &to.materials[from_mesh.material - from.materials.data()];
+  }
+}
+
+void orient(Camera &cam) {
+  cam.orientation.v = cam.up;
+  cam.orientation.w = -cam.gaze;
+  cam.orientation.u = cross(cam.orientation.v, cam.orientation.w);
+}
+
+V3 center(const Scene &scene) {
+  if (scene.vertices.empty())
+    return v3(0, 0, 0);
+
+  V3 lo = scene.vertices[0];
+  V3 hi = lo;
+
+  for (const V3 &v : scene.vertices) {
+    lo = v3(std::min(lo.x, v.x), std::min(lo.y, v.y), std::min(lo.z, v.z));
+    hi = v3(std::max(hi.x, v.x), std::max(hi.y, v.y), std::max(hi.z, v.z));
+  }
+
+  return (lo + hi) * 0.5f;
+}
+
+/// v turned by the angle of cos_a and sin_a around unit axis k (Rodrigues).
+static V3 rotate(V3 v, V3 k, f32 cos_a, f32 sin_a) {
+  return v * cos_a + cross(k, v) * sin_a + k * (dot(k, v) * (1 - cos_a));
+}
+
+void orbit(Camera &cam, V3 pivot, f32 angle) {
+  const V3 axis = norm(cam.up);
+  const f32 cos_a = cosf(angle);
+  const f32 sin_a = sinf(angle);
+
+  cam.pos = pivot + rotate(cam.pos - pivot, axis, cos_a, sin_a);
+  cam.gaze = rotate(cam.gaze, axis, cos_a, sin_a);
+  orient(cam);
+}
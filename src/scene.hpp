@@ -29,6 +29,19 @@ struct PointLight {
   V3 intensity; 
 };
 
+/// How specular() raises to the phong exponent, see prepare_material().
+enum class PhongKind : u32 {
+  integer,   // repeated squaring with phong_int
+  table,     // linear interpolation in phong_table
+  reference, // plain pow(), table error was out of bound
+};
+
+namespace phong {
+constexpr u32 max_integer = 1 << 16;
+constexpr u32 table_size = 4096;
+constexpr f32 max_table_error = 1.0f / 4096;
+} // namespace phong
+
 struct Material {
   std::string id;
   V3 ambient;
@@ -36,11 +49,53 @@ struct Material {
   V3 specular;
   f32 phong;
   V3 reflectance;
+
+  PhongKind phong_kind;
+  u32 phong_int;
+  std::vector<f32> phong_table; // table_size + 1 samples of x^phong in [0, 1]
 };
 
 int material_by_id(Material *&material, std::vector<Material> &materials,
                    const char *name);
 
+inline f32 pow_int(f32 x, u32 n) {
+  f32 result = 1;
+
+  for (; n > 0; n >>= 1) {
+    if (n & 1)
+      result *= x;
+    x *= x;
+  }
+
+  return result;
+}
+
+inline f32 pow_table(const f32 *table, f32 x) {
+  f32 pos = x * phong::table_size;
+  u32 i = static_cast<u32>(pos);
+
+  if (i >= phong::table_size)
+    return table[phong::table_size];
+
+  f32 t = pos - i;
+  return table[i] + (table[i + 1] - table[i]) * t;
+}
+
+/// x is the clamped cosine in [0, 1].
+inline f32 phong_pow(const Material &mat, f32 x) {
+  switch (mat.phong_kind) {
+  case PhongKind::integer:
+    return pow_int(x, mat.phong_int);
+  case PhongKind::table:
+    // NOTE: a zero area face has a NaN normal, its cosine can't index
+    if (x == x)
+      return pow_table(mat.phong_table.data(), x);
+    [[fallthrough]];
+  default:
+    return pow(x, mat.phong);
+  }
+}
+
 struct TriangleFace {
   union {
     V3 vertices[3];
@@ -58,14 +113,39 @@ struct TriangleFace {
   }
 };
 
+/// Elements stored elsewhere, in a vector of the scene or in place in a
+/// mapped scene file.
+template <class T> struct Span {
+  const T *data = nullptr;
+  size_t size = 0;
+
+  const T *begin() const { return data; }
+  const T *end() const { return data + size; }
+  const T &operator[](size_t i) const { return data[i]; }
+  bool empty() const { return size == 0; }
+};
+
+template <class T> Span<T> span_of(const std::vector<T> &v) {
+  return {v.data(), v.size()};
+}
+
 // REVIEW: mesh id is not needed in xml
+// NOTE: copies would keep faces pointing into the source, use clone()
 struct Mesh {
-  std::vector<u32> triangle_ids;
-  std::vector<TriangleFace> faces;
+  std::vector<u32> triangle_ids; // 1 indexed as in xml, only when parsed
+  std::vector<TriangleFace> face_storage; // empty if faces are mapped
+  Span<TriangleFace> faces;
 
   Material *material;
+
+  Mesh() = default;
+  Mesh(const Mesh &) = delete;
+  Mesh &operator=(const Mesh &) = delete;
+  Mesh(Mesh &&) = default;
+  Mesh &operator=(Mesh &&) = default;
 };
 
+// NOTE: copies would keep vertices pointing into the source, use clone()
 struct Scene {
   u32 max_ray_trace_depth;
   V3 bg_color;
@@ -74,6 +154,32 @@ struct Scene {
   std::vector<AmbientLight> ambient_lights;
   std::vector<PointLight> point_lights;
   std::vector<Material> materials;
-  std::vector<V3> vertices;
+  std::vector<V3> vertex_storage; // empty if vertices are mapped
+  Span<V3> vertices;
   std::vector<Mesh> meshes; // NOTE: objects field in xml
+
+  Scene() = default;
+  Scene(const Scene &) = delete;
+  Scene &operator=(const Scene &) = delete;
+  Scene(Scene &&) = default;
+  Scene &operator=(Scene &&) = default;
 };
+
+/// Precomputes per material data needed while tracing, call once after the
+/// scene is loaded.
+void prepare_material(Material &material);
+void prepare(Scene &scene);
+
+/// Deep copy with material pointers remapped into the copy, geometry is
+/// copied into the copy's own storage even if it was mapped.
+void clone(Scene &to, const Scene &from);
+
+/// Sets the orientation from gaze and up.
+void orient(Camera &cam);
+
+/// Center of the bounding box of the scene vertices.
+V3 center(const Scene &scene);
+
+/// Turns the camera by angle radians around the axis along its up vector
+/// through pivot, as on a turntable.
+void orbit(Camera &cam, V3 pivot, f32 angle);
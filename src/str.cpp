@@ -1,4 +1,5 @@
 #include "str.hpp"
+#include "pool.hpp"
 #include "scene.hpp"
 #include "vector.hpp"
 
@@ -6,9 +7,19 @@
 #include <ctype.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <charconv>
 
 namespace str {
 
+/// isspace() of the C locale the renderer runs in, without its table
+/// lookup call per char.
+static inline bool is_space(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
 bool is_match_ignore_case(const char *a, const char *b, size_t max_len) {
   for (size_t i = 0; i < max_len; ++i) {
     if (tolower(a[i]) != tolower(b[i]))
@@ -21,7 +32,7 @@ bool is_match_ignore_case(const char *a, const char *b, size_t max_len) {
 }
 
 int find_right_whitespace_end(const char *str, u32 length) {
-  for (; length > 0 && isspace(str[length - 1]); --length)
+  for (; length > 0 && is_space(str[length - 1]); --length)
     ;
 
   return length;
@@ -29,55 +40,169 @@ int find_right_whitespace_end(const char *str, u32 length) {
 
 // NOTE: to_integral fns doesn't care about overflows
 
-int to_integral(f32 &val, const char *str) {
-  char *endptr;
+/// Exact powers of ten a double holds.
+static constexpr double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/// Parses [-]digits[.digits][e[+-]digits] at str the common quick way: the
+/// digits as an integer, then one multiply or divide by a power of ten.
+/// Returns the end of the number, nullptr for what it can't round exactly
+/// like strtof or what isn't a whole token.
+static const char *scan_decimal(f32 &val, const char *str) {
+  const bool is_negative = *str == '-';
+  str += is_negative;
+
+  u64 mantissa = 0;
+  i32 digit_count = 0;
+  i32 scale = 0; // value is mantissa * 10^scale
+
+  for (; static_cast<u8>(*str - '0') < 10; ++str, ++digit_count)
+    mantissa = mantissa * 10 + (*str - '0');
+
+  if (*str == '.') {
+    const char *frac = ++str;
+    for (; static_cast<u8>(*str - '0') < 10; ++str)
+      mantissa = mantissa * 10 + (*str - '0');
+
+    scale = frac - str;
+    digit_count -= scale;
+  }
 
-  f32 parsed = strtof(str, &endptr);
+  if (digit_count == 0 || digit_count > 19)
+    return nullptr;
 
-  if (*endptr != 0 && !isspace(*endptr))
-    return -1;
+  if (*str == 'e' || *str == 'E') {
+    ++str;
+    const bool is_exp_negative = *str == '-';
+    str += *str == '-' || *str == '+';
 
-  val = parsed;
+    i32 exp = 0;
+    const char *exp_digits = str;
+    for (; static_cast<u8>(*str - '0') < 10 && exp < 1000; ++str)
+      exp = exp * 10 + (*str - '0');
 
-  return 0;
+    if (str == exp_digits)
+      return nullptr;
+
+    scale += is_exp_negative ? -exp : exp;
+  }
+
+  if ((*str != 0 && !is_space(*str)) || mantissa > (u64(1) << 53) ||
+      scale < -22 || scale > 22)
+    return nullptr;
+
+  // NOTE: mantissa and the power are exact, so d is the exact value rounded
+  // once to double. Rounding it on to float only errs when d is exactly
+  // halfway between two floats, those go the slow way.
+  double d = static_cast<double>(mantissa);
+  d = scale < 0 ? d / pow10[-scale] : d * pow10[scale];
+
+  u64 bits;
+  memcpy(&bits, &d, sizeof(bits));
+  if ((bits & 0x1fffffff) == 0x10000000)
+    return nullptr;
+
+  val = static_cast<f32>(is_negative ? -d : d);
+  return str;
 }
 
-/// base == 0 is for decimals or [2, 36] see strtol
-int to_integral(i32 &val, const char *str, int base) {
-  char *endptr;
+/// Parses [-]digits of a 32 bit integer at str. Returns the end of the
+/// number, nullptr for what isn't a whole token or may need a base prefix
+/// or more than 9 digits.
+static const char *scan_integer(i32 &val, const char *str) {
+  const bool is_negative = *str == '-';
+  str += is_negative;
 
-  i32 parsed = strtol(str, &endptr, base);
+  const char *digits = str;
+  i32 parsed = 0;
 
-  if (*endptr != 0 && !isspace(*endptr))
-    return -1;
+  for (; static_cast<u8>(*str - '0') < 10 && str - digits < 9; ++str)
+    parsed = parsed * 10 + (*str - '0');
 
-  val = parsed;
+  if (str == digits || (*str != 0 && !is_space(*str)) ||
+      (*digits == '0' && str - digits > 1))
+    return nullptr;
 
-  return 0;
+  val = is_negative ? -parsed : parsed;
+  return str;
 }
 
-/// base == 0 is for decimals or [2, 36] see strtol
-int to_integral(u32 &val, const char *str, int base) {
-  char *endptr;
-  i32 parsed = strtol(str, &endptr, base);
+/// Skips the whitespace strto* skip and a '+', which strto* take but not
+/// before another sign.
+static const char *number_begin(const char *str) {
+  while (is_space(*str))
+    ++str;
 
-  if (*endptr != 0 && !isspace(*endptr))
-    return -1;
+  if (*str == '+' && str[1] != '+' && str[1] != '-')
+    ++str;
 
-  if (parsed < 0)
-    return -2;
+  return str;
+}
 
-  val = parsed;
+// NOTE: the scan_number fns are locale independent and much faster than
+// the strto* fns. They return false to leave str to strto* when they
+// wouldn't take it the same way: base prefixes, out of range values or
+// malformed text.
 
-  return 0;
+static bool scan_number(f32 &val, const char *str, char **endptr) {
+  str = number_begin(str);
+
+  if (const char *end = scan_decimal(val, str)) {
+    *endptr = const_cast<char *>(end);
+    return true;
+  }
+
+  const char *last = str;
+  while (*last != 0 && !is_space(*last))
+    ++last;
+
+  // NOTE: NaN payloads of nan(chars) are left to strtof, which keeps them
+  std::from_chars_result result = std::from_chars(str, last, val);
+  if (result.ec != std::errc() || result.ptr != last || isnan(val))
+    return false;
+
+  *endptr = const_cast<char *>(last);
+  return true;
+}
+
+static bool scan_number(i32 &val, const char *str, char **endptr, int base) {
+  if (base != 0 && base != 10)
+    return false;
+
+  const char *end = scan_integer(val, number_begin(str));
+  if (!end)
+    return false;
+
+  *endptr = const_cast<char *>(end);
+  return true;
+}
+
+int to_integral(f32 &val, const char *str) {
+  char *endptr;
+  return to_integral(val, str, &endptr);
+}
+
+/// base == 0 is for decimals or [2, 36] see strtol
+int to_integral(i32 &val, const char *str, int base) {
+  char *endptr;
+  return to_integral(val, str, &endptr, base);
+}
+
+/// base == 0 is for decimals or [2, 36] see strtol
+int to_integral(u32 &val, const char *str, int base) {
+  char *endptr;
+  return to_integral(val, str, &endptr, base);
 }
 
 int to_integral(f32 &val, const char *str, char **endptr) {
   assert(endptr != nullptr);
 
-  f32 parsed = strtof(str, endptr);
+  f32 parsed;
+  if (!scan_number(parsed, str, endptr))
+    parsed = strtof(str, endptr);
 
-  if (**endptr != 0 && !isspace(**endptr))
+  if (**endptr != 0 && !is_space(**endptr))
     return -1;
 
   val = parsed;
@@ -89,9 +214,11 @@ int to_integral(f32 &val, const char *str, char **endptr) {
 int to_integral(i32 &val, const char *str, char **endptr, int base) {
   assert(endptr != nullptr);
 
-  i32 parsed = strtol(str, endptr, base);
+  i32 parsed;
+  if (!scan_number(parsed, str, endptr, base))
+    parsed = strtol(str, endptr, base);
 
-  if (**endptr != 0 && !isspace(**endptr))
+  if (**endptr != 0 && !is_space(**endptr))
     return -1;
 
   val = parsed;
@@ -103,9 +230,11 @@ int to_integral(i32 &val, const char *str, char **endptr, int base) {
 int to_integral(u32 &val, const char *str, char **endptr, int base) {
   assert(endptr != nullptr);
 
-  i32 parsed = strtol(str, endptr, base);
+  i32 parsed;
+  if (!scan_number(parsed, str, endptr, base))
+    parsed = strtol(str, endptr, base);
 
-  if (**endptr != 0 && !isspace(**endptr))
+  if (**endptr != 0 && !is_space(**endptr))
     return -1;
 
   if (parsed < 0)
@@ -213,8 +342,92 @@ int to_array(std::vector<T> &arr, const char *str, u32 str_length) {
 
   return 0;
 }
+template int to_array(std::vector<f32> &arr, const char *str, u32 str_length);
 template int to_array(std::vector<u32> &arr, const char *str, u32 str_length);
 
+/// Text at least this long is parsed in parallel chunks.
+constexpr u32 parallel_min_length = 1 << 20;
+
+/// Chunks per worker, a few balance uneven number lengths.
+constexpr u32 chunks_per_worker = 4;
+
+template <class T>
+int to_chunks(std::vector<std::vector<T>> &chunks, const char *str,
+              u32 str_length) {
+  const u32 chunk_count =
+      str_length < parallel_min_length
+          ? 1
+          : std::min(pool::worker_count() * chunks_per_worker,
+                     str_length / (parallel_min_length / chunks_per_worker));
+
+  // NOTE: chunk ends are moved onto whitespace so no number is split, a
+  // chunk parses up to its trimmed end like any text
+  std::vector<u32> ends(chunk_count);
+  for (u32 i = 0, end = 0; i < chunk_count; ++i) {
+    end = std::max(end, static_cast<u32>(static_cast<u64>(str_length) *
+                                         (i + 1) / chunk_count));
+    while (end < str_length && !is_space(str[end]))
+      ++end;
+    ends[i] = end;
+  }
+
+  chunks.assign(chunk_count, {});
+  std::vector<int> statuses(chunk_count);
+
+  pool::parallel_for(chunk_count, [&](u32 chunk, u32) {
+    const u32 beg = chunk == 0 ? 0 : ends[chunk - 1];
+    chunks[chunk].reserve((ends[chunk] - beg) / 4);
+    statuses[chunk] =
+        to_array(chunks[chunk], str + beg, ends[chunk] - beg);
+  });
+
+  // NOTE: the first failing chunk holds the error the sequential parse
+  // would have stopped at
+  for (int status : statuses) {
+    if (status < 0)
+      return status;
+  }
+
+  return 0;
+}
+template int to_chunks(std::vector<std::vector<f32>> &chunks, const char *str,
+                       u32 str_length);
+template int to_chunks(std::vector<std::vector<u32>> &chunks, const char *str,
+                       u32 str_length);
+
+template <class T>
+void join(T *out, const std::vector<std::vector<T>> &chunks) {
+  std::vector<size_t> offsets(chunks.size());
+  for (size_t i = 1; i < chunks.size(); ++i)
+    offsets[i] = offsets[i - 1] + chunks[i - 1].size();
+
+  pool::parallel_for(chunks.size(), [&](u32 chunk, u32) {
+    std::copy(chunks[chunk].begin(), chunks[chunk].end(),
+              out + offsets[chunk]);
+  });
+}
+template void join(f32 *out, const std::vector<std::vector<f32>> &chunks);
+template void join(u32 *out, const std::vector<std::vector<u32>> &chunks);
+
+template <class T>
+int to_array_parallel(std::vector<T> &arr, const char *str, u32 str_length) {
+  std::vector<std::vector<T>> chunks;
+  int status = to_chunks(chunks, str, str_length);
+  if (status < 0)
+    return status;
+
+  size_t count = 0;
+  for (const std::vector<T> &chunk : chunks)
+    count += chunk.size();
+
+  const size_t base = arr.size();
+  arr.resize(base + count);
+  join(arr.data() + base, chunks);
+  return 0;
+}
+template int to_array_parallel(std::vector<u32> &arr, const char *str,
+                               u32 str_length);
+
 int to_vector(V2 &v2, const char *str) { return to_array(v2.e, str, 2); }
 int to_vector(V2u &v2, const char *str) { return to_array(v2.e, str, 2); }
   
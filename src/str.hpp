@@ -23,6 +23,21 @@ int to_array(T *arr, u32 &count, const char *str, u32 str_length,
 template <class T>
 int to_array(std::vector<T> &arr, const char *str, u32 str_length);
 
+/// Same numbers as to_array() above, long text is split at whitespace into
+/// chunks parsed in parallel on the pool. Numbers of chunk i follow those of
+/// chunk i - 1.
+template <class T>
+int to_chunks(std::vector<std::vector<T>> &chunks, const char *str,
+              u32 str_length);
+
+/// Copies chunks back to back into out, in parallel.
+template <class T>
+void join(T *out, const std::vector<std::vector<T>> &chunks);
+
+/// to_array() of long text through to_chunks(), appends to arr.
+template <class T>
+int to_array_parallel(std::vector<T> &arr, const char *str, u32 str_length);
+
 // NOTE: only valid types that can use base conversion
 int to_array(u32 *arr, u32 &count, const char *str, u32 str_length,
              u32 max_count, int base);
@@ -0,0 +1,201 @@
+#include "tile.hpp"
+#include "timer.hpp"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <utility>
+
+namespace tile {
+
+int split(std::vector<Tile> &tiles, V2u resolution, u32 size) {
+  if (size == 0) {
+    fprintf(stderr, "Tile size can't be 0!\n");
+    return -1;
+  }
+
+  tiles.clear();
+
+  for (u32 y = 0; y < resolution.y; y += size) {
+    for (u32 x = 0; x < resolution.x; x += size) {
+      Tile tile;
+      tile.beg = v2u(x, y);
+      tile.end = v2u(x + size < resolution.x ? x + size : resolution.x,
+                     y + size < resolution.y ? y + size : resolution.y);
+      tiles.push_back(tile);
+    }
+  }
+
+  return 0;
+}
+
+void clip(std::vector<Tile> &tiles, const Tile &rect) {
+  std::vector<Tile> clipped;
+
+  for (Tile tile : tiles) {
+    for (int a = 0; a < 2; ++a) {
+      if (tile.beg.e[a] < rect.beg.e[a])
+        tile.beg.e[a] = rect.beg.e[a];
+      if (tile.end.e[a] > rect.end.e[a])
+        tile.end.e[a] = rect.end.e[a];
+    }
+
+    if (tile.beg.x < tile.end.x && tile.beg.y < tile.end.y)
+      clipped.push_back(tile);
+  }
+
+  tiles.swap(clipped);
+}
+
+int select(std::vector<Tile> &tiles, const std::vector<u32> &ids) {
+  std::vector<Tile> selected;
+
+  for (u32 id : ids) {
+    if (id >= tiles.size()) {
+      fprintf(stderr, "Tile %u is out of range, image has %zu tiles!\n", id,
+              tiles.size());
+      return -1;
+    }
+
+    selected.push_back(tiles[id]);
+  }
+
+  tiles.swap(selected);
+  return 0;
+}
+
+Tile bounds(const std::vector<Tile> &tiles) {
+  if (tiles.empty())
+    return {v2u(0, 0), v2u(0, 0)};
+
+  Tile rect = tiles[0];
+
+  for (const Tile &tile : tiles) {
+    for (int a = 0; a < 2; ++a) {
+      if (tile.beg.e[a] < rect.beg.e[a])
+        rect.beg.e[a] = tile.beg.e[a];
+      if (tile.end.e[a] > rect.end.e[a])
+        rect.end.e[a] = tile.end.e[a];
+    }
+  }
+
+  return rect;
+}
+
+void deal(Scheduler &sched, u32 tile_count, u32 worker_count) {
+  sched.queues.reset(new Queue[worker_count]);
+  sched.queue_count = worker_count;
+  sched.first_idle_ns = 0;
+
+  for (u32 i = 0; i < tile_count; ++i)
+    sched.queues[i % worker_count].tiles.push_back(i);
+}
+
+void deal_by_cost(Scheduler &sched, const std::vector<umax> &costs,
+                  u32 worker_count) {
+  deal_by_cost(sched, costs, std::vector<u32>(costs.size(), 0),
+               std::vector<u32>(worker_count, 0));
+}
+
+void deal_by_cost(Scheduler &sched, const std::vector<umax> &costs,
+                  const std::vector<u32> &tile_groups,
+                  const std::vector<u32> &worker_groups) {
+  using Load = std::pair<umax, u32>; // estimated load, worker
+  using Loads =
+      std::priority_queue<Load, std::vector<Load>, std::greater<Load>>;
+  const u32 worker_count = worker_groups.size();
+  const u32 group_count =
+      *std::max_element(worker_groups.begin(), worker_groups.end()) + 1;
+  std::vector<Loads> loads(group_count);
+  std::vector<u32> order(costs.size());
+
+  sched.queues.reset(new Queue[worker_count]);
+  sched.queue_count = worker_count;
+  sched.first_idle_ns = 0;
+
+  for (u32 i = 0; i < order.size(); ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(),
+                   [&](u32 a, u32 b) { return costs[a] > costs[b]; });
+
+  for (u32 w = 0; w < worker_count; ++w)
+    loads[worker_groups[w]].push({0, w});
+
+  for (u32 id : order) {
+    Loads &group = loads[tile_groups[id]];
+    Load least = group.top();
+    group.pop();
+
+    sched.queues[least.second].tiles.push_back(id);
+    group.push({least.first + costs[id], least.second});
+  }
+}
+
+void deal(Scheduler &sched, const std::vector<u32> &owners, u32 worker_count) {
+  sched.queues.reset(new Queue[worker_count]);
+  sched.queue_count = worker_count;
+  sched.first_idle_ns = 0;
+
+  for (u32 i = 0; i < owners.size(); ++i)
+    sched.queues[owners[i]].tiles.push_back(i);
+}
+
+static bool pop_front(Queue &queue, u32 &tile_id) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+
+  if (queue.tiles.empty())
+    return false;
+
+  tile_id = queue.tiles.front();
+  queue.tiles.pop_front();
+  return true;
+}
+
+static bool pop_back(Queue &queue, u32 &tile_id) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+
+  if (queue.tiles.empty())
+    return false;
+
+  tile_id = queue.tiles.back();
+  queue.tiles.pop_back();
+  return true;
+}
+
+void push(Scheduler &sched, u32 worker, u32 beg, u32 end) {
+  Queue &queue = sched.queues[worker];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+
+  for (u32 id = beg; id < end; ++id)
+    queue.tiles.push_back(id);
+}
+
+bool take(Scheduler &sched, u32 worker, u32 &tile_id) {
+  if (pop_front(sched.queues[worker], tile_id))
+    return true;
+
+  // NOTE: start stealing from the neighbour so thieves don't pile on one queue
+  for (u32 i = 1; i < sched.queue_count; ++i) {
+    if (pop_back(sched.queues[(worker + i) % sched.queue_count], tile_id))
+      return true;
+  }
+
+  return false;
+}
+
+bool next(Scheduler &sched, u32 worker, u32 &tile_id) {
+  if (take(sched, worker, tile_id))
+    return true;
+
+  mark_idle(sched);
+  return false;
+}
+
+void mark_idle(Scheduler &sched) {
+  umax idle = 0;
+  sched.first_idle_ns.compare_exchange_strong(idle, timer::now_ns());
+}
+
+} // namespace tile
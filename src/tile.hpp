@@ -0,0 +1,101 @@
+#pragma once
+
+/// Splits the image into tiles and hands them out to workers. Every worker
+/// owns a deque, it takes tiles from the front of its own deque and steals
+/// from the back of the others when it runs dry.
+
+#include "vector.hpp"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace tile {
+
+constexpr u32 default_size = 32;
+
+struct Tile {
+  V2u beg; // first pixel
+  V2u end; // one past last pixel
+};
+
+constexpr u32 width(const Tile &tile) { return tile.end.x - tile.beg.x; }
+constexpr u32 height(const Tile &tile) { return tile.end.y - tile.beg.y; }
+
+int split(std::vector<Tile> &tiles, V2u resolution, u32 size);
+
+/// Cuts tiles down to their part inside rect, dropping the ones outside.
+void clip(std::vector<Tile> &tiles, const Tile &rect);
+
+/// Keeps only the tiles with given ids, ids index the tiles as split.
+int select(std::vector<Tile> &tiles, const std::vector<u32> &ids);
+
+/// Smallest rect covering every tile.
+Tile bounds(const std::vector<Tile> &tiles);
+
+/// Interlaced passes for progressive rendering, pass 0 is every
+/// coarse_stride'th pixel on both axes and each following pass halves the
+/// grid, adding only the pixels that aren't on a coarser one.
+constexpr u32 coarse_stride = 8;
+constexpr u32 pass_count = 4;
+
+constexpr u32 pass_stride(u32 pass) { return coarse_stride >> pass; }
+
+constexpr u32 pass_of(V2u pixel) {
+  u32 pass = 0;
+  while (pass + 1 < pass_count &&
+         (pixel.x % pass_stride(pass) || pixel.y % pass_stride(pass)))
+    ++pass;
+  return pass;
+}
+
+struct Queue {
+  std::mutex mutex;
+  std::deque<u32> tiles;
+};
+
+struct Scheduler {
+  std::unique_ptr<Queue[]> queues;
+  u32 queue_count;
+
+  /// When a worker first found no tile left, the render tail starts there.
+  std::atomic<umax> first_idle_ns{0};
+};
+
+/// Deals tile ids round robin so costly image regions spread over workers.
+void deal(Scheduler &sched, u32 tile_count, u32 worker_count);
+
+/// Deals longest tiles first, each to the worker with the least estimated
+/// load so far. Workers take their own tiles costliest first and thieves
+/// steal the cheap ones from the back.
+void deal_by_cost(Scheduler &sched, const std::vector<umax> &costs,
+                  u32 worker_count);
+
+/// Same, but balances each group on its own, a tile only goes to the
+/// workers of its group. Every group of tile_groups needs a worker in
+/// worker_groups.
+void deal_by_cost(Scheduler &sched, const std::vector<umax> &costs,
+                  const std::vector<u32> &tile_groups,
+                  const std::vector<u32> &worker_groups);
+
+/// Deals tile ids to the given owner workers.
+void deal(Scheduler &sched, const std::vector<u32> &owners, u32 worker_count);
+
+/// Appends tile ids [beg, end) to the deque of worker, for schedules that
+/// deal tiles while others are already taken.
+void push(Scheduler &sched, u32 worker, u32 beg, u32 end);
+
+/// Takes a tile of worker's own deque or steals one, returns false when
+/// every deque is empty.
+bool take(Scheduler &sched, u32 worker, u32 &tile_id);
+
+/// Returns false when there is no tile left anywhere.
+bool next(Scheduler &sched, u32 worker, u32 &tile_id);
+
+/// Records when the first worker ran out of tiles, for schedules that
+/// hand out tiles with take().
+void mark_idle(Scheduler &sched);
+
+} // namespace tile
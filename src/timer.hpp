@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <time.h>
+
+namespace timer {
+
+/// Monotonic clock in nanoseconds.
+inline umax now_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<umax>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+}
+
+inline double seconds(umax beg_ns, umax end_ns) {
+  return (end_ns - beg_ns) * 1e-9;
+}
+
+} // namespace timer
@@ -0,0 +1,148 @@
+#include "tonemap.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TONEMAP_AVX2 1
+#endif
+
+namespace tonemap {
+
+constexpr f32 max_value = 255;
+constexpr f32 inv_max_value = 1 / max_value;
+
+// NOTE: gamma is looked up by the square root of the value, which spreads
+// the table evenly over the steep dark end of the curve
+constexpr u32 gamma_steps = 65535;
+
+/// Output step for every sqrt(value) step, padded so 4 byte gathers at the
+/// last entry stay inside.
+struct GammaTable {
+  u8 steps[gamma_steps + 4];
+};
+
+static const GammaTable &gamma_table() {
+  static const GammaTable table = [] {
+    GammaTable table = {};
+    for (u32 i = 0; i <= gamma_steps; ++i) {
+      const double root = static_cast<double>(i) / gamma_steps;
+      table.steps[i] = static_cast<u8>(pow(root, 2 / 2.2) * max_value);
+    }
+    return table;
+  }();
+
+  return table;
+}
+
+static u8 map(f32 v, Operator op, const u8 *gamma) {
+  v = v > 0 ? v : 0;
+
+  switch (op) {
+  case Operator::linear:
+    return static_cast<u8>(std::min(v, max_value));
+  case Operator::reinhard: {
+    const f32 n = v * inv_max_value;
+    return static_cast<u8>(n / (1 + n) * max_value);
+  }
+  case Operator::gamma: {
+    const f32 n = std::min(v * inv_max_value, 1.0f);
+    return gamma[static_cast<u32>(sqrtf(n) * gamma_steps)];
+  }
+  }
+
+  return 0;
+}
+
+static void pack_scalar(u8 *out, const f32 *in, size_t count, Operator op,
+                        const u8 *gamma) {
+  for (size_t i = 0; i < count; ++i)
+    out[i] = map(in[i], op, gamma);
+}
+
+#ifdef TONEMAP_AVX2
+/// Same operations as map() on 8 channels, so both give the same bytes.
+__attribute__((target("avx2"))) static inline __m256i
+map8(__m256 v, Operator op, const u8 *gamma) {
+  const __m256 max = _mm256_set1_ps(max_value);
+  const __m256 inv_max = _mm256_set1_ps(inv_max_value);
+
+  // NOTE: max_ps gives its 2nd operand for NaN, like the scalar compare
+  v = _mm256_max_ps(v, _mm256_setzero_ps());
+
+  switch (op) {
+  case Operator::linear:
+    return _mm256_cvttps_epi32(_mm256_min_ps(v, max));
+  case Operator::reinhard: {
+    const __m256 n = _mm256_mul_ps(v, inv_max);
+    const __m256 mapped =
+        _mm256_div_ps(n, _mm256_add_ps(_mm256_set1_ps(1), n));
+    return _mm256_cvttps_epi32(_mm256_mul_ps(mapped, max));
+  }
+  case Operator::gamma: {
+    const __m256 n = _mm256_min_ps(_mm256_mul_ps(v, inv_max), _mm256_set1_ps(1));
+    const __m256i index = _mm256_cvttps_epi32(
+        _mm256_mul_ps(_mm256_sqrt_ps(n), _mm256_set1_ps(gamma_steps)));
+    const __m256i steps = _mm256_i32gather_epi32(
+        reinterpret_cast<const int *>(gamma), index, 1);
+    return _mm256_and_si256(steps, _mm256_set1_epi32(0xff));
+  }
+  }
+
+  return _mm256_setzero_si256();
+}
+
+__attribute__((target("avx2"))) static void
+pack_avx2(u8 *out, const f32 *in, size_t count, Operator op, const u8 *gamma) {
+  size_t i = 0;
+
+  // NOTE: 8 pixels are 24 channels, three vectors packed to 24 bytes. The
+  // packs work per 128 bit lane, the permutes put the lanes back in order.
+  for (; i + 24 <= count; i += 24) {
+    const __m256i a = map8(_mm256_loadu_ps(in + i), op, gamma);
+    const __m256i b = map8(_mm256_loadu_ps(in + i + 8), op, gamma);
+    const __m256i c = map8(_mm256_loadu_ps(in + i + 16), op, gamma);
+
+    const __m256i ab = _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8);
+    const __m256i cc = _mm256_permute4x64_epi64(_mm256_packus_epi32(c, c), 0xd8);
+    const __m256i bytes =
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(ab, cc), 0xd8);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm256_castsi256_si128(bytes));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(out + i + 16),
+                     _mm256_extracti128_si256(bytes, 1));
+  }
+
+  pack_scalar(out + i, in + i, count - i, op, gamma);
+}
+#endif
+
+f32 invisible_change(Operator op) {
+  // NOTE: linear and reinhard never grow faster than 1, gamma is concave so
+  // a change moves it most from 0
+  if (op == Operator::gamma)
+    return max_value * powf(0.5f * inv_max_value, 2.2f);
+
+  return 0.5f;
+}
+
+void pack(u8 *out, const V3 *data, size_t count, Operator op) {
+  static_assert(sizeof(V3) == 3 * sizeof(f32), "colors are packed floats");
+  const f32 *in = reinterpret_cast<const f32 *>(data);
+  const u8 *gamma = op == Operator::gamma ? gamma_table().steps : nullptr;
+
+#ifdef TONEMAP_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2) {
+    pack_avx2(out, in, count * 3, op, gamma);
+    return;
+  }
+#endif
+
+  pack_scalar(out, in, count * 3, op, gamma);
+}
+
+} // namespace tonemap
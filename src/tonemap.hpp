@@ -0,0 +1,26 @@
+#pragma once
+
+/// Post-process from the float framebuffer to 8 bit RGB: clamp, tonemap and
+/// quantize. Uses AVX2 where the CPU has it.
+
+#include "types.hpp"
+#include "vector.hpp"
+
+#include <stddef.h>
+
+namespace tonemap {
+
+enum class Operator {
+  linear,   // clamp to 0-255
+  reinhard, // c / (1 + c) on 1 as full white
+  gamma,    // clamp, then 1 / 2.2 gamma
+};
+
+/// Largest change of a value in 0-255 steps that moves its mapped value by
+/// less than half an output step, wherever the value starts.
+f32 invisible_change(Operator op);
+
+/// Packs count colors in 0-255 output steps into count * 3 bytes.
+void pack(u8 *out, const V3 *data, size_t count, Operator op);
+
+} // namespace tonemap
@@ -4,6 +4,9 @@
 
 using f32 = float;
 using i32 = int32_t;
+using u8 = uint8_t;
+using u16 = uint16_t;
 using u32 = uint32_t;
+using u64 = uint64_t;
 
 using umax = uintmax_t;
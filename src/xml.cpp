@@ -1,4 +1,5 @@
 #include "xml.hpp"
+#include "pool.hpp"
 #include "str.hpp"
 
 #include "rapidxml/rapidxml.hpp"
@@ -6,6 +7,8 @@
 #include <cstring>
 #include <stdio.h>
 
+#include <algorithm>
+
 using namespace rapidxml;
 
 namespace xml {
@@ -19,6 +22,9 @@ constexpr const char *fmt_bad_format =
 constexpr const char *fmt_bad_value =
   "Failed to get value of '%s' node in XML\n";
 
+/// Faces a task builds from vertex ids.
+constexpr u32 faces_per_block = 1 << 14;
+
 // TODO: should take node_name size optionally and pass to first_node()
   xml_node<> *first_node(const xml_node<> *parent, const char *node_name,
 			 bool print_err = true) {
@@ -81,9 +87,7 @@ int node_to_camera(Camera &cam, const xml_node<> *parent,
   status |= node_to_integral(cam.near_dist, cam_root, "neardistance");
   status |= node_to_vector(cam.resolution, cam_root, "imageresolution");
 
-  cam.orientation.v = cam.up;
-  cam.orientation.w = -cam.gaze;
-  cam.orientation.u = cross(cam.orientation.v, cam.orientation.w);
+  orient(cam);
 
   if (status < 0) {
     fprintf(stderr, fmt_bad_format, "camera");
@@ -220,7 +224,7 @@ int node_to_array(std::vector<T> &arr, const xml_node<> *parent,
   if (val == nullptr)
     return 0;
 
-  return str::to_array(arr, val, node->value_size());
+  return str::to_array_parallel(arr, val, node->value_size());
 }
 
 template <class T>
@@ -249,20 +253,21 @@ int node_to_vertices(std::vector<V3> &arr, const xml_node<> *parent,
   if(str == nullptr)
     return 0;
 
-  char *endptr = nullptr;
-  const char *str_end =
-    str + str::find_right_whitespace_end(str, node->value_size());
+  // NOTE: coordinates are parsed as one list, so a vertex may span chunks,
+  // a last partial vertex is zero filled
+  std::vector<std::vector<f32>> chunks;
+  int status = str::to_chunks(chunks, str, node->value_size());
+  if (status < 0)
+    return status;
 
-  for (u32 i = 0; str < str_end; ++i) {
-    if(i % 3 == 0) {
-      arr.emplace_back();
-    }
-    V3 &v = arr.back();
-    int status = str::to_integral(v.e[i%3], str, &endptr);
-    if (status < 0)
-      return status;
-    str = endptr;
-  }
+  size_t count = 0;
+  for (const std::vector<f32> &chunk : chunks)
+    count += chunk.size();
+
+  static_assert(sizeof(V3) == 3 * sizeof(f32), "vertices are packed floats");
+  const size_t base = arr.size();
+  arr.resize(base + (count + 2) / 3);
+  str::join(reinterpret_cast<f32 *>(arr.data() + base), chunks);
 
   return 0;
 }
@@ -289,17 +294,40 @@ int node_to_scene_meshes(Scene &scene, const xml_node<> *parent,
       fprintf(stderr, fmt_bad_format, "mesh");
       return status;
     }
+  }
 
-    // NOTE: also remapping 1 indexed faces to 0 index
+  // NOTE: faces are built in blocks over all meshes so a big mesh spreads
+  // over the workers too
+  struct FaceBlock {
+    u32 mesh_id;
+    u32 beg;
+    u32 end;
+  };
+  std::vector<FaceBlock> blocks;
+
+  for (u32 mesh_id = 0; mesh_id < scene.meshes.size(); ++mesh_id) {
+    Mesh &mesh = scene.meshes[mesh_id];
     u32 face_count = mesh.triangle_ids.size() / 3;
-    for (u32 i = 0; i < face_count; ++i) {
-      mesh.faces.emplace_back();
-      TriangleFace &face = mesh.faces.back();
+
+    mesh.face_storage.resize(face_count);
+    mesh.faces = span_of(mesh.face_storage);
+    for (u32 beg = 0; beg < face_count; beg += faces_per_block)
+      blocks.push_back(
+          {mesh_id, beg, std::min(beg + faces_per_block, face_count)});
+  }
+
+  // NOTE: also remapping 1 indexed faces to 0 index
+  pool::parallel_for(blocks.size(), [&](u32 block_id, u32) {
+    const FaceBlock &block = blocks[block_id];
+    Mesh &mesh = scene.meshes[block.mesh_id];
+
+    for (u32 i = block.beg; i < block.end; ++i) {
+      TriangleFace &face = mesh.face_storage[i];
       face.a = scene.vertices[mesh.triangle_ids[i * 3] - 1];
       face.b = scene.vertices[mesh.triangle_ids[i * 3 + 1] - 1];
       face.c = scene.vertices[mesh.triangle_ids[i * 3 + 2] - 1];
     }
-  }
+  });
 
   return 0;
 }
@@ -327,8 +355,12 @@ int to_scene(Scene &scene, char *xml) {
   status |= node_to_ambient_lights(scene.ambient_lights, root, "lights");
   status |= node_to_point_lights(scene.point_lights, root, "lights");
   status |= node_to_materials(scene.materials, root, "materials");
-  status |= node_to_vertices(scene.vertices, root, "vertexdata");
-  status |= node_to_scene_meshes(scene, root, "objects");
+  status |= node_to_vertices(scene.vertex_storage, root, "vertexdata");
+  scene.vertices = span_of(scene.vertex_storage);
+
+  // NOTE: faces index the vertices, so they're only built from a whole list
+  if (status >= 0)
+    status |= node_to_scene_meshes(scene, root, "objects");
 
   if (status < 0)
     fprintf(stderr, fmt_bad_format, "scene");
@@ -0,0 +1,369 @@
+/// Round trips a scene through binary::write and binary::to_scene field by
+/// field, then checks that truncated and out of range files are rejected.
+
+#include "binary.hpp"
+#include "file.hpp"
+#include "pool.hpp"
+#include "scene.hpp"
+#include "test.hpp"
+#include "xml.hpp"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/// Every section has elements, the second mesh uses the first material.
+static const char scene_xml[] = R"(<scene>
+  <maxraytracedepth>5</maxraytracedepth>
+  <background>1 2 3</background>
+  <camera>
+    <position>0.5 -1 2</position>
+    <gaze>0 0.2 -1</gaze>
+    <up>0 1 0.1</up>
+    <nearplane>-1 1 -0.75 0.75</nearplane>
+    <neardistance>1.5</neardistance>
+    <imageresolution>40 30</imageresolution>
+  </camera>
+  <lights>
+    <ambientlight>25 20 15</ambientlight>
+    <pointlight id="1">
+      <position>0 4 0</position>
+      <intensity>1000 900 800</intensity>
+    </pointlight>
+    <pointlight id="2">
+      <position>-3 1 2.5</position>
+      <intensity>500 500 500</intensity>
+    </pointlight>
+  </lights>
+  <materials>
+    <material id="1">
+      <ambient>0.1 0.1 0.1</ambient>
+      <diffuse>0.5 0.25 1</diffuse>
+      <specular>1 1 1</specular>
+      <phongexponent>12.5</phongexponent>
+      <mirrorreflectance>0.3 0.2 0.1</mirrorreflectance>
+    </material>
+    <material id="2">
+      <ambient>0 0 0</ambient>
+      <diffuse>1 1 1</diffuse>
+      <specular>0 0 0</specular>
+      <phongexponent>1</phongexponent>
+      <mirrorreflectance>0 0 0</mirrorreflectance>
+    </material>
+  </materials>
+  <vertexdata>
+    -0.5 0.5 -2
+    -0.5 -0.5 -2
+    0.5 -0.5 -2
+    0.5 0.5 -2
+    -5 -1 -10
+    5 -1 -10
+    0 -1 10
+  </vertexdata>
+  <objects>
+    <mesh id="1">
+      <materialid>2</materialid>
+      <faces>
+        3 1 2
+        1 3 4
+      </faces>
+    </mesh>
+    <mesh id="2">
+      <materialid>1</materialid>
+      <faces>
+        5 6 7
+        7 6 5
+        1 5 7
+      </faces>
+    </mesh>
+  </objects>
+</scene>)";
+
+/// Sections of the header and the size of their elements.
+static binary::Section binary::Header::*const sections[] = {
+    &binary::Header::ambient_lights, &binary::Header::point_lights,
+    &binary::Header::materials,      &binary::Header::vertices,
+    &binary::Header::meshes,         &binary::Header::indices,
+    &binary::Header::faces,
+};
+static const umax sizes[] = {
+    sizeof(AmbientLight),           sizeof(PointLight),
+    sizeof(binary::MaterialRecord), sizeof(V3),
+    sizeof(binary::MeshRecord),     sizeof(u32),
+    sizeof(TriangleFace),
+};
+
+namespace test {
+
+static int failures = 0;
+
+static void fail(const char *what) {
+  if (++failures <= 16)
+    fprintf(stderr, "binary scene: %s\n", what);
+}
+
+/// Bitwise, so -0 and NaN count too.
+template <class T> static bool is_same(const T &a, const T &b) {
+  return memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+template <class T>
+static bool is_same_array(const T *a, size_t a_size, const T *b,
+                          size_t b_size) {
+  return a_size == b_size &&
+         (a_size == 0 || memcmp(a, b, a_size * sizeof(T)) == 0);
+}
+
+static void compare(const Scene &xml, const Scene &loaded,
+                    const std::vector<char> &data) {
+  if (xml.max_ray_trace_depth != loaded.max_ray_trace_depth)
+    fail("max ray trace depth");
+  if (!is_same(xml.bg_color, loaded.bg_color))
+    fail("background");
+
+  const Camera &a = xml.cam;
+  const Camera &b = loaded.cam;
+  if (!is_same(a.pos, b.pos) || !is_same(a.gaze, b.gaze) ||
+      !is_same(a.up, b.up) || !is_same(a.near_plane, b.near_plane) ||
+      !is_same(a.near_dist, b.near_dist) ||
+      !is_same(a.resolution, b.resolution))
+    fail("camera");
+  if (!is_same(a.orientation.u, b.orientation.u) ||
+      !is_same(a.orientation.v, b.orientation.v) ||
+      !is_same(a.orientation.w, b.orientation.w))
+    fail("camera orientation");
+
+  if (!is_same_array(xml.ambient_lights.data(), xml.ambient_lights.size(),
+                     loaded.ambient_lights.data(),
+                     loaded.ambient_lights.size()))
+    fail("ambient lights");
+  if (!is_same_array(xml.point_lights.data(), xml.point_lights.size(),
+                     loaded.point_lights.data(), loaded.point_lights.size()))
+    fail("point lights");
+
+  if (xml.materials.size() != loaded.materials.size()) {
+    fail("material count");
+  } else {
+    for (size_t i = 0; i < xml.materials.size(); ++i) {
+      const Material &x = xml.materials[i];
+      const Material &y = loaded.materials[i];
+
+      if (!is_same(x.ambient, y.ambient) || !is_same(x.diffuse, y.diffuse) ||
+          !is_same(x.specular, y.specular) || !is_same(x.phong, y.phong) ||
+          !is_same(x.reflectance, y.reflectance))
+        fail("material");
+    }
+  }
+
+  // NOTE: loaded geometry must point into the file, not into copies
+  const char *data_end = data.data() + data.size();
+  auto is_in_data = [&](const void *p) {
+    return static_cast<const char *>(p) >= data.data() &&
+           static_cast<const char *>(p) < data_end;
+  };
+
+  if (!is_same_array(xml.vertices.data, xml.vertices.size,
+                     loaded.vertices.data, loaded.vertices.size))
+    fail("vertices");
+  if (!loaded.vertex_storage.empty() || !is_in_data(loaded.vertices.data))
+    fail("vertices aren't mapped in place");
+
+  binary::Header header;
+  memcpy(&header, data.data(), sizeof(header));
+  const u32 *indices =
+      reinterpret_cast<const u32 *>(data.data() + header.indices.offset);
+
+  if (xml.meshes.size() != loaded.meshes.size()) {
+    fail("mesh count");
+    return;
+  }
+
+  for (size_t i = 0; i < xml.meshes.size(); ++i) {
+    const Mesh &x = xml.meshes[i];
+    const Mesh &y = loaded.meshes[i];
+
+    if (x.material - xml.materials.data() !=
+        y.material - loaded.materials.data())
+      fail("mesh material");
+    if (!is_same_array(x.faces.data, x.faces.size, y.faces.data,
+                       y.faces.size))
+      fail("mesh faces");
+    if (!y.face_storage.empty() || !is_in_data(y.faces.data))
+      fail("faces aren't mapped in place");
+
+    // NOTE: ids are stored 0 indexed, mesh after mesh
+    for (u32 id : x.triangle_ids) {
+      if (*indices++ != id - 1)
+        fail("face indices");
+    }
+  }
+}
+
+/// to_scene of a damaged file, which prints why it is rejected.
+static int to_scene_quiet(const std::vector<char> &data, umax size) {
+  fflush(stderr);
+  const int saved = dup(STDERR_FILENO);
+  const int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDERR_FILENO);
+  close(null);
+
+  Scene scene;
+  const int status = binary::to_scene(scene, data.data(), size);
+
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+  return status;
+}
+
+static void expect_rejected(const std::vector<char> &data, umax size,
+                            const char *what) {
+  if (to_scene_quiet(data, size) == 0)
+    fail(what);
+}
+
+static void set_header(std::vector<char> &data, const binary::Header &header) {
+  memcpy(data.data(), &header, sizeof(header));
+}
+
+static void check_truncated(const std::vector<char> &data) {
+  for (umax size : {umax(0), umax(7), umax(sizeof(binary::Header) - 1),
+                    umax(data.size() - 1)})
+    expect_rejected(data, size, "truncated file is accepted");
+
+  binary::Header header;
+  memcpy(&header, data.data(), sizeof(header));
+
+  // NOTE: with the recorded size cut too, only the section bounds are left
+  // to catch the last element of each section missing
+  for (size_t i = 0; i < std::size(sections); ++i) {
+    const binary::Section &section = header.*sections[i];
+    std::vector<char> cut(data);
+    binary::Header cut_header = header;
+
+    cut_header.file_size = section.offset + section.count * sizes[i] - 1;
+    set_header(cut, cut_header);
+    expect_rejected(cut, cut_header.file_size,
+                    "file cut inside a section is accepted");
+  }
+}
+
+static void check_out_of_range(const std::vector<char> &data) {
+  binary::Header header;
+  memcpy(&header, data.data(), sizeof(header));
+
+  auto expect_header_rejected = [&](auto change, const char *what) {
+    std::vector<char> bad(data);
+    binary::Header bad_header = header;
+    change(bad_header);
+    set_header(bad, bad_header);
+    expect_rejected(bad, bad.size(), what);
+  };
+
+  expect_header_rejected([](binary::Header &h) { h.magic[0] = 'X'; },
+                         "bad magic is accepted");
+  expect_header_rejected([](binary::Header &h) { ++h.version; },
+                         "other version is accepted");
+  expect_header_rejected(
+      [](binary::Header &h) { h.byte_order_mark = 0x04030201; },
+      "other byte order is accepted");
+  expect_header_rejected([](binary::Header &h) { --h.file_size; },
+                         "wrong file size is accepted");
+
+  for (size_t i = 0; i < std::size(sections); ++i) {
+    const auto section = sections[i];
+    const u64 fitting =
+        (data.size() - (header.*section).offset) / sizes[i];
+
+    expect_header_rejected(
+        [&](binary::Header &h) { (h.*section).offset = data.size(); },
+        "section past the end is accepted");
+    expect_header_rejected(
+        [&](binary::Header &h) { (h.*section).offset = ~u64(0) & ~u64(63); },
+        "section offset past the end is accepted");
+    expect_header_rejected(
+        [&](binary::Header &h) { (h.*section).count = fitting + 1; },
+        "section count past the end is accepted");
+    expect_header_rejected(
+        [&](binary::Header &h) { (h.*section).count = ~u64(0); },
+        "overflowing section count is accepted");
+    expect_header_rejected([&](binary::Header &h) { ++(h.*section).offset; },
+                           "misaligned section is accepted");
+  }
+
+  // NOTE: mesh records index into the materials and faces
+  auto expect_mesh_rejected = [&](auto change, const char *what) {
+    std::vector<char> bad(data);
+    binary::MeshRecord record;
+    char *at = bad.data() + header.meshes.offset +
+               (header.meshes.count - 1) * sizeof(record);
+
+    memcpy(&record, at, sizeof(record));
+    change(record);
+    memcpy(at, &record, sizeof(record));
+    expect_rejected(bad, bad.size(), what);
+  };
+
+  expect_mesh_rejected(
+      [&](binary::MeshRecord &r) { r.material = header.materials.count; },
+      "mesh material out of range is accepted");
+  expect_mesh_rejected(
+      [&](binary::MeshRecord &r) { r.first_face = header.faces.count + 1; },
+      "mesh faces past the end are accepted");
+  expect_mesh_rejected([&](binary::MeshRecord &r) { ++r.face_count; },
+                       "mesh face count past the end is accepted");
+  expect_mesh_rejected(
+      [&](binary::MeshRecord &r) { r.face_count = ~u64(0); },
+      "overflowing mesh face count is accepted");
+}
+
+int binary_scene() {
+  const std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      ("rrtest_" + std::to_string(getpid()) + ".rrs");
+
+  if (pool::init(2) < 0)
+    return -1;
+
+  std::vector<char> xml_text(std::begin(scene_xml), std::end(scene_xml));
+  Scene xml;
+  std::vector<char> data;
+  umax size = 0;
+
+  if (xml::to_scene(xml, xml_text.data()) < 0) {
+    fail("XML scene doesn't parse");
+  } else if (binary::write(xml, path) < 0 || file::size(size, path) < 0) {
+    fail("scene isn't written");
+  } else {
+    data.resize(size);
+    char *out = data.data();
+    if (file::read(out, path, size) < 0)
+      fail("scene isn't read back");
+  }
+
+  std::filesystem::remove(path);
+  pool::shutdown();
+
+  if (failures > 0)
+    return -1;
+
+  Scene loaded;
+  if (binary::to_scene(loaded, data.data(), data.size()) < 0) {
+    fail("written scene is rejected");
+    return -1;
+  }
+
+  compare(xml, loaded, data);
+  check_truncated(data);
+  check_out_of_range(data);
+
+  return failures > 0 ? -1 : 0;
+}
+
+} // namespace test
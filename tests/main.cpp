@@ -0,0 +1,33 @@
+/// Runs every check of renderer internals.
+///
+/// Usage: rrtest
+
+#include "test.hpp"
+
+#include <stdio.h>
+
+struct Check {
+  const char *name;
+  int (*run)();
+};
+
+static const Check checks[] = {
+    {"phong", test::phong},
+    {"numbers", test::numbers},
+    {"binary_scene", test::binary_scene},
+};
+
+int main() {
+  int status = 0;
+
+  for (const Check &check : checks) {
+    if (check.run() < 0) {
+      fprintf(stderr, "FAIL %s\n", check.name);
+      status = -1;
+    } else {
+      fprintf(stderr, "ok   %s\n", check.name);
+    }
+  }
+
+  return status;
+}
@@ -0,0 +1,115 @@
+/// Checks every way specular() raises to the phong exponent against pow()
+/// over a sweep of exponents and cosines.
+
+#include "scene.hpp"
+#include "test.hpp"
+
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+constexpr u32 cosine_steps = 1 << 16;
+
+/// Exponents, integers take the repeated squaring path, the others the
+/// table unless it is off by more than phong::max_table_error.
+static const f32 exponents[] = {
+    0,     1,    2,     3,    7,     10,     31,      64,      100,
+    255,   1000, 4097,  65535, 65536, 65537, 1e6f,    0.01f,   0.1f,
+    0.25f, 0.5f, 0.75f, 1.5f, 2.3f,  3.7f,   10.5f,   42.42f,  100.25f,
+    511.5f, 1000.5f, 4096.5f, 65536.5f,
+};
+
+namespace test {
+
+static int failures = 0;
+static u32 kind_counts[3] = {};
+
+static void fail(const Material &mat, f32 x, f32 got, f32 expected,
+                 const char *what) {
+  if (++failures <= 16)
+    fprintf(stderr, "phong %g at %.9g: %s gave %.9g, pow() %.9g\n",
+            mat.phong, x, what, got, expected);
+}
+
+/// Table as prepare_material() builds it, whatever kind it picked.
+static std::vector<f32> table_of(f32 phong) {
+  std::vector<f32> table(phong::table_size + 1);
+  for (u32 i = 0; i <= phong::table_size; ++i)
+    table[i] = pow(static_cast<f32>(i) / phong::table_size, phong);
+
+  return table;
+}
+
+static void check(f32 phong) {
+  Material mat = {};
+  mat.phong = phong;
+  prepare_material(mat);
+  ++kind_counts[static_cast<u32>(mat.phong_kind)];
+
+  const bool is_integer = phong <= phong::max_integer && phong == floorf(phong);
+  if (is_integer != (mat.phong_kind == PhongKind::integer))
+    fail(mat, 0, static_cast<f32>(mat.phong_kind), 0, "kind");
+
+  const std::vector<f32> table = table_of(phong);
+  f32 worst_table_error = 0;
+
+  for (u32 i = 0; i <= cosine_steps; ++i) {
+    const f32 x = static_cast<f32>(i) / cosine_steps;
+    const f32 expected = pow(x, phong);
+    const f32 got = phong_pow(mat, x);
+
+    switch (mat.phong_kind) {
+    case PhongKind::integer: {
+      // NOTE: every squaring doubles the relative error of the one before,
+      // so x^n is off by n roundings at most. Denormals only keep an
+      // absolute error.
+      const f32 bound = (phong + 1) * FLT_EPSILON * expected + 1e-30f;
+      if (fabsf(pow_int(x, mat.phong_int) - expected) > bound)
+        fail(mat, x, got, expected, "pow_int()");
+      break;
+    }
+    case PhongKind::table:
+      if (fabsf(pow_table(mat.phong_table.data(), x) - expected) >
+          phong::max_table_error)
+        fail(mat, x, got, expected, "table");
+      break;
+    case PhongKind::reference:
+      if (got != expected)
+        fail(mat, x, got, expected, "pow() path");
+      worst_table_error = fmaxf(worst_table_error,
+                                fabsf(pow_table(table.data(), x) - expected));
+      break;
+    }
+
+    if (fabsf(got - expected) > phong::max_table_error)
+      fail(mat, x, got, expected, "phong_pow()");
+  }
+
+  // NOTE: a table is only given up when it really is off somewhere
+  if (mat.phong_kind == PhongKind::reference && phong > 0 &&
+      worst_table_error <= phong::max_table_error)
+    fail(mat, 0, worst_table_error, phong::max_table_error,
+         "table fallback");
+
+  const f32 nan = NAN;
+  if (isnan(phong_pow(mat, nan)) != isnan(powf(nan, phong)))
+    fail(mat, nan, phong_pow(mat, nan), powf(nan, phong), "NaN cosine");
+}
+
+int phong() {
+  for (f32 exponent : exponents)
+    check(exponent);
+
+  for (u32 count : kind_counts) {
+    if (count == 0) {
+      fprintf(stderr, "Exponents don't cover every phong kind\n");
+      ++failures;
+    }
+  }
+
+  return failures > 0 ? -1 : 0;
+}
+
+} // namespace test
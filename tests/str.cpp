@@ -0,0 +1,222 @@
+/// Checks str::to_integral, whose scanners skip strtof() and strtol() for
+/// plain decimals, against those calls over edge cases and random tokens.
+
+#include "str.hpp"
+#include "test.hpp"
+
+#include <ctype.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/// Tokens every scanner has to agree with strto* on, whole or cut short.
+static const char *const tokens[] = {
+    // NOTE: empty, whitespace and lone signs or dots
+    "", " ", "\t\n", "-", "+", ".", "-.", "+.", "e5", ".e5",
+    // NOTE: leading zeros, octal looking for strtol with base 0
+    "0", "-0", "+0", "00", "007", "0008", "09", "-007", "0.5", "000.25",
+    "00000000000000000001", "0.", ".5", "5.", "5.e3", "-.5e-1",
+    // NOTE: signs
+    "+1", "-1", "+-1", "-+1", "--1", "++1", " +1.5", "\t-2.25", "+ 1",
+    // NOTE: 9, 10, 19 and 20 digit mantissas and 32 bit limits
+    "123456789", "-123456789", "999999999", "1234567890", "2147483647",
+    "2147483648", "-2147483648", "-2147483649", "4294967295", "4294967296",
+    "1234567890123456789", "12345678901234567890", "9007199254740992",
+    "9007199254740993", "18446744073709551615", "18446744073709551616",
+    "0.1234567890123456789", "0.12345678901234567890",
+    "1234567890.123456789", "0.0000000000000000001",
+    "123456789012345678901234567890",
+    // NOTE: exponents at and past the power table and the float range
+    "1e0", "1e+5", "1e-5", "1E5", "1e22", "1e23", "1e-22", "1e-23",
+    "3.4028234e38", "3.4028236e38", "1e38", "1e39", "-1e39", "1e-38",
+    "1e-45", "1e-46", "1.4e-45", "7e-46", "1e999999", "1e-999999",
+    "1e2147483648", "1e4294967296", "1e-4294967297", "1e0000000000000000003",
+    "1e", "1e+", "1e-", "1ee5", "1e5e", "1e+-5", "1.5e3.5",
+    // NOTE: hex, strtof takes hex floats and strtol base 0 and 16 prefixes
+    "0x10", "0X1A", "-0x10", "0x", "0xg", "0x1p3", "0x1.8p1", "0x.8", "ff",
+    "FF", "0b101", "1a", "z",
+    // NOTE: inf and nan spellings
+    "inf", "-inf", "+inf", "INF", "Inf", "infinity", "-Infinity", "infin",
+    "nan", "-nan", "NAN", "nan(123)", "nan()", "nanx",
+    // NOTE: what ends a token
+    "1.5abc", "1.5 next", "  12\t", "12\n", "12\v", "12\f", "12\r", "7,8",
+    "3-4", "1.2.3", "1..2", "- 1", "1 2",
+};
+
+/// Floats with exact decimals halfway between two floats, plus their
+/// neighbours one decimal digit off, and 15-17 digit decimals next to a
+/// midpoint that round to it as a double but not as a float.
+static void add_midpoints(std::vector<std::string> &out) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<f32> exponent(-7, 7);
+  char buf[64];
+
+  for (u32 i = 0; i < 20000; ++i) {
+    const f32 f = powf(10, exponent(rng));
+    const double midpoint =
+        (static_cast<double>(f) + nextafterf(f, INFINITY)) / 2;
+
+    for (const char *format : {"%.15g", "%.16g", "%.17g"}) {
+      snprintf(buf, sizeof(buf), format, midpoint);
+      out.push_back(buf);
+    }
+  }
+
+  for (u64 odd = (1u << 24) + 1; odd < (1u << 24) + 64; odd += 2) {
+    for (u32 shift = 0; shift < 30; ++shift) {
+      const u64 mantissa = odd << shift;
+      for (u64 near = mantissa - 1; near <= mantissa + 1; ++near) {
+        snprintf(buf, sizeof(buf), "%llu",
+                 static_cast<unsigned long long>(near));
+        out.push_back(buf);
+      }
+    }
+
+    // NOTE: odd / 2^k is odd * 5^k / 10^k, exact in k decimals
+    u64 scaled = odd;
+    for (u32 k = 1; k <= 12; ++k) {
+      scaled *= 5;
+      const std::string digits = std::to_string(scaled);
+      const std::string decimal = digits.substr(0, digits.size() - k) + '.' +
+                                  digits.substr(digits.size() - k);
+      out.push_back(decimal);
+      out.push_back('-' + decimal);
+      out.push_back(decimal + '1');
+      out.push_back(std::to_string(scaled) + "e-" + std::to_string(k));
+    }
+  }
+}
+
+/// Random floats and integers written the ways a scene file may hold them.
+static void add_random(std::vector<std::string> &out) {
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<u32> bits;
+  char buf[64];
+
+  for (u32 i = 0; i < 20000; ++i) {
+    u32 raw = bits(rng);
+    f32 f;
+    memcpy(&f, &raw, sizeof(f));
+    if (!isfinite(f))
+      continue;
+
+    static const char *const formats[] = {"%.9g", "%g", "%.3f", "%.17g",
+                                          "%e", "%.0f"};
+    snprintf(buf, sizeof(buf), formats[i % 6], f);
+    out.push_back(buf);
+
+    const f32 small = static_cast<f32>(raw % 2000000) / 1000 - 1000;
+    snprintf(buf, sizeof(buf), formats[i % 3], small);
+    out.push_back(buf);
+
+    snprintf(buf, sizeof(buf), "%d", static_cast<i32>(raw));
+    out.push_back(buf);
+    snprintf(buf, sizeof(buf), "%u", raw % 100000);
+    out.push_back(buf);
+  }
+}
+
+namespace test {
+
+static int failures = 0;
+
+static void fail(const char *type, const std::string &token, int base,
+                 const char *what) {
+  if (++failures <= 16)
+    fprintf(stderr, "%s \"%s\" base %d: %s differs from strto*\n", type,
+            token.c_str(), base, what);
+}
+
+/// Result of to_integral or of the strto* path it replaced.
+template <class T> struct Parse {
+  int status;
+  T val;
+  ptrdiff_t end;
+};
+
+static Parse<f32> reference_f32(const char *str) {
+  Parse<f32> parse = {0, -1, 0};
+  char *endptr;
+
+  const f32 parsed = strtof(str, &endptr);
+  parse.end = endptr - str;
+  if (*endptr != 0 && !isspace(*endptr))
+    parse.status = -1;
+  else
+    parse.val = parsed;
+
+  return parse;
+}
+
+template <class T> static Parse<T> reference_int(const char *str, int base) {
+  Parse<T> parse = {0, 7, 0};
+  char *endptr;
+
+  const i32 parsed = strtol(str, &endptr, base);
+  parse.end = endptr - str;
+  if (*endptr != 0 && !isspace(*endptr))
+    parse.status = -1;
+  else if (parsed < 0 && std::is_unsigned_v<T>)
+    parse.status = -2;
+  else
+    parse.val = parsed;
+
+  return parse;
+}
+
+template <class T>
+static void compare(const char *type, const std::string &token, int base,
+                    const Parse<T> &got, const Parse<T> &expected) {
+  if (got.status != expected.status)
+    fail(type, token, base, "status");
+  if (got.end != expected.end)
+    fail(type, token, base, "end pointer");
+
+  // NOTE: bits, so NaN payloads and -0 count too
+  if (memcmp(&got.val, &expected.val, sizeof(T)) != 0)
+    fail(type, token, base, "value");
+}
+
+static void check(const std::string &token) {
+  const char *str = token.c_str();
+  char *endptr;
+
+  Parse<f32> f = {0, -1, 0};
+  f.status = str::to_integral(f.val, str, &endptr);
+  f.end = endptr - str;
+  compare("f32", token, 10, f, reference_f32(str));
+
+  for (int base : {0, 8, 10, 16}) {
+    Parse<i32> i = {0, 7, 0};
+    i.status = str::to_integral(i.val, str, &endptr, base);
+    i.end = endptr - str;
+    compare("i32", token, base, i, reference_int<i32>(str, base));
+
+    Parse<u32> u = {0, 7, 0};
+    u.status = str::to_integral(u.val, str, &endptr, base);
+    u.end = endptr - str;
+    compare("u32", token, base, u, reference_int<u32>(str, base));
+  }
+}
+
+int numbers() {
+  std::vector<std::string> all(std::begin(tokens), std::end(tokens));
+  add_midpoints(all);
+  add_random(all);
+
+  // NOTE: every prefix too, so numbers cut anywhere are covered
+  for (const std::string &token : all) {
+    for (size_t len = 0; len <= token.size(); ++len)
+      check(token.substr(0, len));
+  }
+
+  return failures > 0 ? -1 : 0;
+}
+
+} // namespace test
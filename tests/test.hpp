@@ -0,0 +1,12 @@
+#pragma once
+
+/// Checks of renderer internals run by rrtest. Each returns 0 when every
+/// check passes, and prints what failed otherwise.
+
+namespace test {
+
+int phong();
+int numbers();
+int binary_scene();
+
+} // namespace test
@@ -0,0 +1,52 @@
+/// Converts an XML scene description to the binary scene format the
+/// renderer maps in place.
+///
+/// Usage: rrscene <scene.xml> <scene.rrs>
+
+#include "binary.hpp"
+#include "file.hpp"
+#include "pool.hpp"
+#include "scene.hpp"
+#include "timer.hpp"
+#include "xml.hpp"
+
+#include <stdio.h>
+
+#include <thread>
+
+int main(int argc, char *argv[]) {
+  if (argc != 3) {
+    fprintf(stderr, "Usage: rrscene <scene.xml> <scene.rrs>\n");
+    return -1;
+  }
+
+  const umax start_ns = timer::now_ns();
+
+  int status = pool::init(std::thread::hardware_concurrency());
+  if (status < 0)
+    return status;
+
+  file::Mapping description;
+  Scene scene;
+
+  status = file::map(description, argv[1]);
+
+  if (status == 0) {
+    status = xml::to_scene(scene, description.data);
+    if (status < 0)
+      fprintf(stderr, "Failed to parse scene %s\n", argv[1]);
+  }
+
+  if (status == 0)
+    status = binary::write(scene, argv[2]);
+
+  if (status == 0) {
+    fprintf(stderr, "Wrote %zu vertices, %zu meshes in %.3f s\n",
+            scene.vertices.size, scene.meshes.size(),
+            timer::seconds(start_ns, timer::now_ns()));
+  }
+
+  pool::shutdown();
+  file::unmap(description);
+  return status;
+}